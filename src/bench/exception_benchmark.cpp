@@ -0,0 +1,111 @@
+/* exception_benchmark.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+// Cost of throwing and catching the error types from error.h, with and without
+// reading what(), at each backtrace level. Usage: template_exception_benchmark [iterations]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "error.h"
+
+extern std::atomic_int g_pre_defined_level;
+
+namespace {
+    def_except_no_trace(plain_error);
+
+    class traced_error final : public cppCowOverlayBaseErrorType {
+        public: explicit traced_error(const std::string & msg) : cppCowOverlayBaseErrorType(require_back_trace, msg) {}
+    };
+
+    std::size_t sink = 0; // keeps what() from being optimized out
+    constexpr long warm_up_iterations = 100;
+
+    template < typename Error >
+    [[gnu::noinline]] void thrower(const int depth)
+    {
+        if (depth == 0) {
+            throw Error("benchmark");
+        }
+        thrower<Error>(depth - 1);
+    }
+
+    template < typename Error >
+    void run(const char * name, const int level, const bool read_what, const long iterations)
+    {
+        g_pre_defined_level = level;
+        const auto throw_once = [read_what]
+        {
+            try {
+                thrower<Error>(8);
+            } catch (const cppCowOverlayBaseErrorType & error) {
+                if (read_what) {
+                    sink += std::char_traits<char>::length(error.what());
+                }
+            }
+        };
+
+        // untimed: the first symbolization loads the ELF and DWARF data, the first throw the unwind tables
+        for (long i = 0; i < warm_up_iterations; i++) {
+            throw_once();
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++) {
+            throw_once();
+        }
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << std::left << std::setw(14) << name
+                  << std::setw(7) << level
+                  << std::setw(8) << (read_what ? "yes" : "no")
+                  << std::right << std::fixed << std::setprecision(1) << std::setw(14)
+                  << elapsed.count() / static_cast<double>(iterations) << " ns/op\n";
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    const long iterations = argc > 1 ? std::strtol(argv[1], nullptr, 10) : 20000;
+    if (iterations <= 0)
+    {
+        std::cerr << "Usage: " << *argv << " [iterations]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "iterations: " << iterations << "\n"
+              << std::left << std::setw(14) << "type" << std::setw(7) << "level"
+              << std::setw(8) << "what()" << std::right << std::setw(20) << "time" << "\n";
+
+    run<plain_error>("no trace", 1, false, iterations);
+    run<plain_error>("no trace", 1, true, iterations);
+    for (const int level : { 1, 2 })
+    {
+        run<traced_error>("traced", level, false, iterations);
+        // level 2 symbolizes every frame, keep it in a range that finishes quickly
+        run<traced_error>("traced", level, true, level == 2 ? std::max(1L, iterations / 10) : iterations);
+    }
+
+    return sink == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
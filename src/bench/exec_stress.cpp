@@ -0,0 +1,104 @@
+/* exec_stress.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+// Concurrent exec_command() calls: every thread pipes its own input through cat and must get exactly
+// that back, and the process must hold as many descriptors afterwards as it did before.
+// Usage: template_exec_stress [threads [calls per thread]]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "execute_command.h"
+
+namespace {
+    constexpr auto command = "/bin/cat";
+
+    std::size_t open_descriptors()
+    {
+        std::size_t count = 0;
+        for ([[maybe_unused]] const auto & entry : std::filesystem::directory_iterator("/proc/self/fd")) {
+            count++;
+        }
+        return count;
+    }
+
+    // distinct per thread and per call, and long enough to need more than one pipe buffer now and then
+    std::string input_for(const long thread, const long call)
+    {
+        std::string input = "thread " + std::to_string(thread) + " call " + std::to_string(call) + ":";
+        const auto padding = static_cast<std::size_t>((thread * 7919 + call * 104729) % 100000);
+        input.append(padding, static_cast<char>('a' + thread % 26));
+        return input;
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    const long threads = argc > 1 ? std::strtol(argv[1], nullptr, 10) : 16;
+    const long calls = argc > 2 ? std::strtol(argv[2], nullptr, 10) : 100;
+    if (threads <= 0 || calls <= 0)
+    {
+        std::cerr << "Usage: " << *argv << " [threads [calls per thread]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::size_t descriptors_before = open_descriptors();
+    std::atomic<long> mismatches = 0;
+    std::atomic<long> failures = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> workers;
+        for (long thread = 0; thread < threads; thread++)
+        {
+            workers.emplace_back([thread, calls, &mismatches, &failures]
+            {
+                for (long call = 0; call < calls; call++)
+                {
+                    const std::string input = input_for(thread, call);
+                    const auto [fd_stdout, fd_stderr, exit_status] = exec_command(command, input);
+                    if (exit_status != 0) {
+                        failures++;
+                    } else if (fd_stdout != input + "\n") { // exec_command() ends the input with a newline
+                        mismatches++;
+                    }
+                }
+            });
+        }
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const std::size_t descriptors_after = open_descriptors();
+
+    std::cout << std::setw(24) << "threads: " << threads << "\n"
+              << std::setw(24) << "calls per thread: " << calls << "\n"
+              << std::setw(24) << "seconds: " << std::fixed << std::setprecision(2) << elapsed.count() << "\n"
+              << std::setw(24) << "failed calls: " << failures << "\n"
+              << std::setw(24) << "foreign outputs: " << mismatches << "\n"
+              << std::setw(24) << "descriptors before: " << descriptors_before << "\n"
+              << std::setw(24) << "descriptors after: " << descriptors_after << "\n";
+
+    return failures == 0 && mismatches == 0 && descriptors_before == descriptors_after ? EXIT_SUCCESS : EXIT_FAILURE;
+}
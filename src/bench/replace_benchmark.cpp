@@ -0,0 +1,107 @@
+/* replace_benchmark.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+// Throughput of the replace_all() forms against the old replace-per-match loop on multi-megabyte
+// text, for replacements that grow, shrink and keep the text size. Usage: template_replace_benchmark [MiB]
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "rstring.h"
+
+namespace {
+    // what replace_all() did before: every replace() shifts the whole tail
+    std::string replace_per_match(std::string original, const std::string & target, const std::string & replacement)
+    {
+        size_t pos = 0;
+        while ((pos = original.find(target, pos)) != std::string::npos) {
+            original.replace(pos, target.length(), replacement);
+            pos += replacement.length();
+        }
+        return original;
+    }
+
+    std::string escaped(const std::string & text)
+    {
+        std::string result = replace_all(std::string_view(text), "\r", "\\r");
+        return replace_all(std::move(result), "\n", "\\n");
+    }
+
+    template < typename Function >
+    void measure(const char * name, const std::string & text, Function && function)
+    {
+        std::size_t result_size = 0;
+        const auto start = std::chrono::steady_clock::now();
+        int runs = 0;
+        do {
+            result_size += function(text).size();
+            runs++;
+        } while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "  " << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << static_cast<double>(text.size()) * runs / elapsed.count() / (1 << 20) << " MiB/s"
+                  << std::setw(12) << elapsed.count() * 1000 / runs << " ms/run" << (result_size == 0 ? " (empty)" : "") << "\n";
+    }
+
+    void run_case(const char * title, const std::string & text, const std::string & target, const std::string & replacement,
+        const bool with_per_match)
+    {
+        std::cout << title << ": \"" << escaped(target) << "\" -> \"" << escaped(replacement) << "\"\n";
+        if (with_per_match) {
+            measure("per match (old)", text, [&](const std::string & t) { return replace_per_match(t, target, replacement); });
+        }
+        measure("string_view copy", text, [&](const std::string & t) { return replace_all(std::string_view(t), target, replacement); });
+        measure("in place", text, [&](const std::string & t) {
+            std::string copy = t;
+            replace_all(copy, target, replacement);
+            return copy;
+        });
+        measure("moved in and out", text, [&](const std::string & t) { return replace_all(std::string(t), target, replacement); });
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    const long mebibytes = argc > 1 ? std::strtol(argv[1], nullptr, 10) : 4;
+    if (mebibytes <= 0)
+    {
+        std::cerr << "Usage: " << *argv << " [MiB]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // log-like lines, one "\r\n" and a few ", " per 40 bytes
+    std::string text;
+    const std::string line = "key=value, id=42, path=/usr/lib, ok\r\n";
+    while (text.size() < static_cast<std::size_t>(mebibytes) << 20) {
+        text += line;
+    }
+
+    // the old loop is quadratic, only run it where it finishes in reasonable time
+    const bool small = mebibytes <= 2;
+    std::cout << "input: " << text.size() << " bytes\n";
+    run_case("grows", text, ", ", ",\n    ", small);
+    run_case("shrinks", text, "\r\n", "\n", small);
+    run_case("same size", text, "id=", "ID=", true);
+    run_case("no match", text, "#", "##", true);
+    return EXIT_SUCCESS;
+}
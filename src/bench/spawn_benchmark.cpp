@@ -0,0 +1,101 @@
+/* spawn_benchmark.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+// Launch latency of exec_command() against a plain fork() + execv(), as the parent's heap grows.
+// Usage: template_spawn_benchmark [iterations [heap MiB...]]
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "execute_command.h"
+
+namespace {
+    constexpr auto command = "/bin/true";
+
+    // what exec_command_() did before posix_spawn(): every fork() copies the page tables of the whole process
+    void fork_exec()
+    {
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            char * const argv[] = { const_cast<char *>(command), nullptr };
+            execv(command, argv);
+            _exit(EXIT_FAILURE);
+        }
+
+        int status;
+        if (pid > 0) {
+            waitpid(pid, &status, 0);
+        }
+    }
+
+    template < typename Function >
+    double microseconds_per_call(const long iterations, Function && function)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++) {
+            function();
+        }
+        const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / static_cast<double>(iterations);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    const long iterations = argc > 1 ? std::strtol(argv[1], nullptr, 10) : 200;
+    std::vector<long> heap_sizes;
+    for (int i = 2; i < argc; i++) {
+        heap_sizes.push_back(std::strtol(argv[i], nullptr, 10));
+    }
+    if (heap_sizes.empty()) {
+        heap_sizes = { 0, 64, 256, 1024 };
+    }
+
+    if (iterations <= 0)
+    {
+        std::cerr << "Usage: " << *argv << " [iterations [heap MiB...]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "iterations: " << iterations << "\n"
+              << std::setw(10) << "heap MiB" << std::setw(22) << "exec_command us" << std::setw(22) << "fork+execv us" << "\n";
+
+    for (const long heap_size : heap_sizes)
+    {
+        // touch every page so it is really mapped and has to be accounted for by fork()
+        const std::size_t bytes = static_cast<std::size_t>(heap_size) << 20;
+        const std::unique_ptr<char[]> heap(new char[bytes + 1]);
+        std::memset(heap.get(), 1, bytes + 1);
+
+        const double spawn = microseconds_per_call(iterations, [] { (void)exec_command(command, ""); });
+        const double fork = microseconds_per_call(iterations, fork_exec);
+        std::cout << std::fixed << std::setprecision(1) << std::setw(10) << heap_size
+                  << std::setw(22) << spawn << std::setw(22) << fork << "\n";
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,351 @@
+/* async_log.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <bit>
+#include <algorithm>
+#include <vector>
+#include "async_log.h"
+#include "log.hpp"
+
+std::atomic_bool debug::async::enabled = false;
+thread_local bool debug::async::on_writer_thread = false;
+
+namespace {
+    // Bounded multi-producer ring (D. Vyukov's sequence-numbered cells).
+    // Pushes and pops are lock-free; the drop_oldest policy lets producers pop too.
+    class record_ring_t
+    {
+        struct alignas(64) cell_t
+        {
+            std::atomic<std::size_t> sequence;
+            std::string record;
+        };
+
+        const std::size_t mask;
+        std::unique_ptr<cell_t[]> cells;
+        alignas(64) std::atomic<std::size_t> enqueue_pos = 0;
+        alignas(64) std::atomic<std::size_t> dequeue_pos = 0;
+
+    public:
+        explicit record_ring_t(const std::size_t capacity)
+            : mask(capacity - 1), cells(std::make_unique<cell_t[]>(capacity))
+        {
+            for (std::size_t i = 0; i < capacity; i++) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool try_push(std::string & record)
+        {
+            std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            cell_t * cell;
+            for (;;)
+            {
+                cell = &cells[pos & mask];
+                const std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+                if (const auto dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos); dif == 0)
+                {
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if (dif < 0) {
+                    return false; // full
+                }
+                else {
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->record = std::move(record);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_pop(std::string & record)
+        {
+            std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            cell_t * cell;
+            for (;;)
+            {
+                cell = &cells[pos & mask];
+                const std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+                if (const auto dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1); dif == 0)
+                {
+                    if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if (dif < 0) {
+                    return false; // empty
+                }
+                else {
+                    pos = dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+
+            record = std::move(cell->record);
+            cell->sequence.store(pos + mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Ring positions handed out to producers so far. Positions are claimed in this order and
+        // popped in it too, a claimed but not yet filled cell stops try_pop() until it is filled.
+        [[nodiscard]] std::size_t enqueued() const
+        {
+            return enqueue_pos.load(std::memory_order_acquire);
+        }
+
+        [[nodiscard]] std::size_t dequeued() const
+        {
+            return dequeue_pos.load(std::memory_order_acquire);
+        }
+    };
+
+    class backend_t
+    {
+        static constexpr std::size_t max_batch = 256;
+
+        std::mutex control_mutex;   // serializes start() / stop()
+        std::unique_ptr<record_ring_t> ring;
+        debug::async::overflow_policy_t policy = debug::async::overflow_policy_t::block;
+        std::thread writer;
+
+        std::atomic_bool running = false;
+        std::atomic_bool stopping = false;
+        std::atomic<std::size_t> in_flight = 0;     // producers currently inside submit()
+        std::atomic<std::uint64_t> doorbell = 0;    // bumped to wake the writer
+        std::atomic<std::uint64_t> retired = 0;     // records written out or discarded
+        std::atomic<std::size_t> flushed = 0;       // every ring position below is written out or discarded
+        std::atomic<std::uint64_t> dropped = 0;
+
+        void wake_writer()
+        {
+            doorbell.fetch_add(1, std::memory_order_release);
+            doorbell.notify_one();
+        }
+
+        void retire(const std::uint64_t count)
+        {
+            retired.fetch_add(count, std::memory_order_release);
+            retired.notify_all();
+        }
+
+        void publish_flushed(const std::size_t position)
+        {
+            if (flushed.load(std::memory_order_relaxed) != position)
+            {
+                flushed.store(position, std::memory_order_release);
+                flushed.notify_all();
+            }
+        }
+
+        void writer_main()
+        {
+            debug::async::on_writer_thread = true;
+            std::vector<std::string> batch(max_batch);
+            std::uint64_t reported_drops = 0;
+
+            for (;;)
+            {
+                const auto bell = doorbell.load(std::memory_order_acquire);
+                // read before draining: once set, no producer can push anymore
+                const bool last_round = stopping.load(std::memory_order_acquire);
+
+                std::size_t count = 0;
+                while (count < max_batch && ring->try_pop(batch[count])) {
+                    count++;
+                }
+                // below this, every record is in the batch or was discarded by a drop_oldest producer
+                const std::size_t popped = ring->dequeued();
+
+                if (const auto drops = dropped.load(std::memory_order_relaxed); drops != reported_drops)
+                {
+                    // formatted like any other record (text, JSON or binary), and written directly
+                    print_log_at(2, drops - reported_drops, " log records dropped\n");
+                    reported_drops = drops;
+                }
+
+                if (count != 0) {
+                    // one writev() for the whole batch
+                    debug::sink::write(std::span(batch.data(), count));
+                }
+                publish_flushed(popped);
+
+                if (count != 0)
+                {
+                    retire(count);
+                    continue;
+                }
+
+                if (last_round) {
+                    break;
+                }
+
+                doorbell.wait(bell, std::memory_order_acquire);
+            }
+        }
+
+    public:
+        void start(std::size_t capacity, const debug::async::overflow_policy_t overflow_policy)
+        {
+            std::lock_guard lock(control_mutex);
+            if (running) {
+                return;
+            }
+
+            ring = std::make_unique<record_ring_t>(std::bit_ceil(std::max<std::size_t>(capacity, 2)));
+            policy = overflow_policy;
+            stopping = false;
+            dropped = 0;
+            flushed = 0;
+            writer = std::thread(&backend_t::writer_main, this);
+            running = true;
+            debug::async::enabled = true;
+        }
+
+        void stop()
+        {
+            std::lock_guard lock(control_mutex);
+            if (!running) {
+                return;
+            }
+
+            debug::async::enabled = false;
+            running = false;
+            // producers that raced past the check above still finish their push
+            while (in_flight.load() != 0) {
+                std::this_thread::yield();
+            }
+
+            stopping.store(true, std::memory_order_release);
+            wake_writer();
+            writer.join();
+            ring.reset();
+        }
+
+        void submit(std::string & record)
+        {
+            in_flight.fetch_add(1);
+            if (!running.load())
+            {
+                in_flight.fetch_sub(1);
+                debug::sink::write(record);
+                return;
+            }
+
+            for (;;)
+            {
+                const auto seen = retired.load(std::memory_order_acquire);
+                if (ring->try_push(record)) {
+                    break;
+                }
+
+                if (policy == debug::async::overflow_policy_t::drop)
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    in_flight.fetch_sub(1, std::memory_order_release);
+                    return;
+                }
+
+                if (policy == debug::async::overflow_policy_t::drop_oldest)
+                {
+                    if (std::string oldest; ring->try_pop(oldest))
+                    {
+                        dropped.fetch_add(1, std::memory_order_relaxed);
+                        retire(1);
+                    }
+                    continue;
+                }
+
+                // block: let the writer make room
+                wake_writer();
+                retired.wait(seen, std::memory_order_acquire);
+            }
+
+            in_flight.fetch_sub(1, std::memory_order_release);
+            wake_writer();
+        }
+
+        void flush()
+        {
+            // the writer never waits for itself
+            if (!running.load() || debug::async::on_writer_thread)
+            {
+                debug::sink::flush();
+                return;
+            }
+
+            // A ticket in ring order: waiting for a record count instead would let a producer that
+            // stalled between claiming its cell and counting it hide a later record from the count.
+            const std::size_t ticket = ring->enqueued();
+            wake_writer();
+            for (auto done = flushed.load(std::memory_order_acquire); done < ticket;
+                done = flushed.load(std::memory_order_acquire))
+            {
+                flushed.wait(done, std::memory_order_acquire);
+            }
+        }
+
+        [[nodiscard]] std::uint64_t dropped_count() const
+        {
+            return dropped.load(std::memory_order_relaxed);
+        }
+
+        ~backend_t()
+        {
+            stop();
+        }
+    };
+
+    backend_t & backend()
+    {
+        static backend_t instance;
+        return instance;
+    }
+}
+
+void debug::async::start(const std::size_t capacity, const overflow_policy_t policy)
+{
+    backend().start(capacity, policy);
+}
+
+void debug::async::stop()
+{
+    backend().stop();
+}
+
+void debug::async::submit(std::string record)
+{
+    backend().submit(record);
+}
+
+void debug::async::flush()
+{
+    backend().flush();
+}
+
+std::uint64_t debug::async::dropped()
+{
+    return backend().dropped_count();
+}
@@ -0,0 +1,91 @@
+/* binary_log.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <mutex>
+#include "binary_log.h"
+#include "log_file.h"
+
+namespace {
+    std::mutex site_mutex;
+    std::uint32_t next_site_id = 1;
+    std::once_flag header_once;
+
+    // Header and site records are written straight out, even in async mode: no log record can name a site
+    // before its record is out, and an overflowing ring can never drop them. The journal repeats them
+    // at the start of every segment, each segment file decodes on its own.
+    void write_out(const std::string & data)
+    {
+        if (debug::log_file::enabled) {
+            debug::log_file::add_preamble(data);
+        }
+
+        debug::sink::write(data);
+    }
+
+    void emit_header()
+    {
+        std::call_once(header_once, []
+        {
+            std::string header(debug::binary::magic, sizeof(debug::binary::magic));
+            debug::binary::put(header, static_cast<std::uint8_t>(VERBOSE));
+            debug::binary::put_string(header, BUILD_ID);
+            const std::int64_t second = debug::timestamp::clock_ns() / 1000000000;
+            debug::binary::put(header, static_cast<std::int32_t>(debug::timestamp::utc_offset(second)));
+            write_out(header);
+        });
+    }
+}
+
+std::string & debug::binary::record_buffer()
+{
+    thread_local std::string buffer;
+    return buffer;
+}
+
+std::uint32_t debug::binary::thread_number()
+{
+    static std::atomic<std::uint32_t> next_number = 1;
+    thread_local const std::uint32_t number = next_number.fetch_add(1, std::memory_order_relaxed);
+    return number;
+}
+
+std::uint32_t debug::binary::register_site(const call_site_t & site, const std::string_view signature)
+{
+    std::lock_guard lock(site_mutex);
+    if (const auto id = site.binary_id.load(std::memory_order_acquire); id != 0) {
+        return id; // another thread got here first
+    }
+
+    emit_header();
+    const std::uint32_t id = next_site_id++;
+    std::string record;
+    put(record, static_cast<std::uint8_t>(site_record));
+    put(record, id);
+    put(record, static_cast<std::uint32_t>(site.level));
+    put(record, static_cast<std::uint32_t>(site.line));
+    put_string(record, site.function);
+    put_string(record, site.file);
+    put_string(record, signature);
+    write_out(record);
+
+    // only published once the site record is out, so no log record can overtake it
+    site.binary_id.store(id, std::memory_order_release);
+    return id;
+}
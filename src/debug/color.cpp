@@ -20,11 +20,60 @@
 
 #include <string>
 #include <algorithm>
+#include <array>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <atomic>
 #include "color.h"
 
+namespace {
+    // one xterm 256 color escape sequence, "\033[38;5;NNNm" at most
+    struct escape_t
+    {
+        char text[12] {};
+        std::size_t length = 0;
+    };
+
+    // the 6x6x6 color cube, index 36 * r + 6 * g + b
+    consteval std::array<escape_t, 216> make_table(const char layer)
+    {
+        std::array<escape_t, 216> table {};
+        for (int index = 0; index < 216; index++)
+        {
+            auto & entry = table[index];
+            for (const char c : { '\033', '[', layer, '8', ';', '5', ';' }) {
+                entry.text[entry.length++] = c;
+            }
+
+            const int scale = 16 + index;
+            if (scale >= 100) {
+                entry.text[entry.length++] = static_cast<char>('0' + scale / 100);
+            }
+            if (scale >= 10) {
+                entry.text[entry.length++] = static_cast<char>('0' + scale / 10 % 10);
+            }
+            entry.text[entry.length++] = static_cast<char>('0' + scale % 10);
+            entry.text[entry.length++] = 'm';
+        }
+        return table;
+    }
+
+    constexpr auto foreground_table = make_table('3');
+    constexpr auto background_table = make_table('4');
+
+    constexpr std::string_view lookup(const std::array<escape_t, 216> & table, int r, int g, int b)
+    {
+        r = std::clamp(r, 0, 5);
+        g = std::clamp(g, 0, 5);
+        b = std::clamp(b, 0, 5);
+        const auto & entry = table[36 * r + 6 * g + b];
+        return { entry.text, entry.length };
+    }
+
+    static_assert(lookup(foreground_table, 0, 0, 0) == "\033[38;5;16m");
+    static_assert(lookup(background_table, 5, 5, 5) == "\033[48;5;231m");
+}
+
 std::string get_env(const std::string & name)
 {
     const char * ptr = std::getenv(name.c_str());
@@ -38,41 +87,33 @@ std::string get_env(const std::string & name)
 
 std::atomic_bool color::g_no_color;
 
+// COLOR and the terminal check are resolved once (thread-safe), g_no_color is still honored when set later
 bool is_no_color()
 {
-    static int is_no_color_cache = -1;
-    if (is_no_color_cache != -1) {
-        return is_no_color_cache;
-    }
-
-    auto color_env = get_env("COLOR");
-    std::ranges::transform(color_env, color_env.begin(), ::tolower);
-
-    if (color_env == "always")
+    enum decision_t { colored, plain, ask_flag };
+    static const decision_t decision = []
     {
-        is_no_color_cache = 0;
-        return false;
-    }
+        auto color_env = get_env("COLOR");
+        std::ranges::transform(color_env, color_env.begin(), ::tolower);
 
-    const bool no_color_from_env = color_env == "never" || color_env == "none" || color_env == "off"
-                            || color_env == "no" || color_env == "n" || color_env == "0" || color_env == "false";
-    bool is_terminal = false;
-    struct stat st{};
-    if (fstat(STDOUT_FILENO, &st) == -1)
-    {
-        is_no_color_cache = true;
-    }
+        if (color_env == "always") {
+            return colored;
+        }
 
-    if (isatty(STDOUT_FILENO))
-    {
-        is_terminal = true;
-    }
+        const bool no_color_from_env = color_env == "never" || color_env == "none" || color_env == "off"
+                                || color_env == "no" || color_env == "n" || color_env == "0" || color_env == "false";
+        struct stat st{};
+        if (no_color_from_env || fstat(STDOUT_FILENO, &st) == -1 || !isatty(STDOUT_FILENO)) {
+            return plain;
+        }
+
+        return ask_flag;
+    }();
 
-    is_no_color_cache = no_color_from_env || !is_terminal || color::g_no_color;
-    return is_no_color_cache;
+    return decision == plain || (decision == ask_flag && color::g_no_color.load(std::memory_order_relaxed));
 }
 
-std::string color::no_color()
+std::string_view color::no_color()
 {
     if (!is_no_color())
     {
@@ -89,49 +130,27 @@ std::string color::color(const int r, const int g, const int b, const int br, co
         return "";
     }
 
-    return color(r, g, b) + bg_color(br, bg, bb);
+    std::string result(color(r, g, b));
+    result += bg_color(br, bg, bb);
+    return result;
 }
 
-std::string color::color(int r, int g, int b)
+std::string_view color::color(const int r, const int g, const int b)
 {
     if (is_no_color())
     {
         return "";
     }
 
-    auto constrain = [](int var, const int min, const int max)->int
-    {
-        var = std::max(var, min);
-        var = std::min(var, max);
-        return var;
-    };
-
-    r = constrain(r, 0, 5);
-    g = constrain(g, 0, 5);
-    b = constrain(b, 0, 5);
-
-    const int scale = 16 + 36 * r + 6 * g + b;
-    return "\033[38;5;" + std::to_string(scale) + "m";
+    return lookup(foreground_table, r, g, b);
 }
 
-std::string color::bg_color(int r, int g, int b)
+std::string_view color::bg_color(const int r, const int g, const int b)
 {
     if (is_no_color())
     {
         return "";
     }
 
-    auto constrain = [](int var, const int min, const int max)->int
-    {
-        var = std::max(var, min);
-        var = std::min(var, max);
-        return var;
-    };
-
-    r = constrain(r, 0, 5);
-    g = constrain(g, 0, 5);
-    b = constrain(b, 0, 5);
-
-    const int scale = 16 + 36 * r + 6 * g + b;
-    return "\033[48;5;" + std::to_string(scale) + "m";
+    return lookup(background_table, r, g, b);
 }
@@ -0,0 +1,273 @@
+/* crash_handler.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "crash_handler.h"
+
+#define MAX_CRASH_FRAMES (128)
+
+namespace {
+    constexpr int handled_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+    int dump_fd = -1;
+    std::atomic_flag crashing = ATOMIC_FLAG_INIT;
+
+    // Small fixed buffer formatter, nothing here may allocate or take a lock
+    class signal_writer_t
+    {
+        char buffer[512] {};
+        std::size_t length = 0;
+
+    public:
+        signal_writer_t & operator<<(const char * str)
+        {
+            while (*str != '\0' && length < sizeof(buffer)) {
+                buffer[length++] = *str++;
+            }
+            return *this;
+        }
+
+        signal_writer_t & put_number(std::uint64_t value, const unsigned base)
+        {
+            char digits[24];
+            int count = 0;
+            do
+            {
+                digits[count++] = "0123456789abcdef"[value % base];
+                value /= base;
+            } while (value != 0);
+
+            while (count > 0 && length < sizeof(buffer)) {
+                buffer[length++] = digits[--count];
+            }
+            return *this;
+        }
+
+        signal_writer_t & operator<<(const std::int64_t value)
+        {
+            if (value < 0)
+            {
+                *this << "-";
+                return put_number(-static_cast<std::uint64_t>(value), 10);
+            }
+            return put_number(value, 10);
+        }
+
+        signal_writer_t & operator<<(const void * pointer)
+        {
+            *this << "0x";
+            return put_number(reinterpret_cast<std::uintptr_t>(pointer), 16);
+        }
+
+        void flush(const int fd)
+        {
+            const char * data = buffer;
+            while (length > 0)
+            {
+                const ssize_t written = write(fd, data, length);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    break;
+                }
+                data += written;
+                length -= written;
+            }
+            length = 0;
+        }
+    };
+
+    const char * signal_name(const int signal)
+    {
+        switch (signal)
+        {
+            case SIGSEGV: return "SIGSEGV";
+            case SIGBUS: return "SIGBUS";
+            case SIGFPE: return "SIGFPE";
+            case SIGILL: return "SIGILL";
+            case SIGABRT: return "SIGABRT";
+            default: return "signal";
+        }
+    }
+
+    void copy_memory_map(const int fd)
+    {
+        const int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+        if (maps < 0) {
+            return;
+        }
+
+        char buffer[4096];
+        ssize_t size;
+        while ((size = read(maps, buffer, sizeof(buffer))) > 0 || (size < 0 && errno == EINTR))
+        {
+            for (ssize_t offset = 0; offset < size;)
+            {
+                const ssize_t written = write(fd, buffer + offset, size - offset);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    close(maps);
+                    return;
+                }
+                offset += written;
+            }
+        }
+        close(maps);
+    }
+
+    void on_crash(const int signal, siginfo_t * info, void *)
+    {
+        const int saved_errno = errno;
+
+        // A second thread crashing meanwhile waits for the first one to take the process down. The
+        // handler stays installed until then (no SA_RESETHAND), so this holds for the same signal too.
+        if (crashing.test_and_set())
+        {
+            while (true) {
+                pause();
+            }
+        }
+
+        timespec now {};
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        signal_writer_t writer;
+        writer << "\n*** " << signal_name(signal) << " (signal " << static_cast<std::int64_t>(signal) << ")";
+        if (signal == SIGSEGV || signal == SIGBUS || signal == SIGFPE || signal == SIGILL) {
+            writer << " at address " << info->si_addr;
+        }
+        writer << "\n*** build " << BUILD_ID
+               << ", pid " << static_cast<std::int64_t>(getpid())
+               << ", tid " << static_cast<std::int64_t>(syscall(SYS_gettid))
+               << ", time " << static_cast<std::int64_t>(now.tv_sec) << "\n"
+               << "*** backtrace:\n";
+        writer.flush(dump_fd);
+
+        void * frames[MAX_CRASH_FRAMES];
+        const int count = backtrace(frames, MAX_CRASH_FRAMES);
+        backtrace_symbols_fd(frames, count, dump_fd);
+
+        writer << "*** memory map:\n";
+        writer.flush(dump_fd);
+        copy_memory_map(dump_fd);
+        writer << "*** end of crash dump\n";
+        writer.flush(dump_fd);
+        fsync(dump_fd);
+
+        // restore the default action and let it produce the usual exit status and core dump
+        struct sigaction default_action {};
+        default_action.sa_handler = SIG_DFL;
+        sigemptyset(&default_action.sa_mask);
+        sigaction(signal, &default_action, nullptr);
+        errno = saved_errno;
+        raise(signal);
+    }
+}
+
+bool debug::crash_handler::protect_thread()
+{
+    const std::size_t size = std::max<std::size_t>(SIGSTKSZ, 64 * 1024);
+    void * stack = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == MAP_FAILED) {
+        return false;
+    }
+
+    const stack_t alternate { .ss_sp = stack, .ss_flags = 0, .ss_size = size };
+    if (sigaltstack(&alternate, nullptr) == -1)
+    {
+        const int error = errno;
+        munmap(stack, size);
+        errno = error;
+        return false;
+    }
+
+    return true;
+}
+
+bool debug::crash_handler::install(const char * path)
+{
+    if (dump_fd != -1) {
+        return true;
+    }
+
+    const int fd = std::strcmp(path, "stderr") == 0 ? STDERR_FILENO
+        : open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (!protect_thread())
+    {
+        const int error = errno;
+        if (fd != STDERR_FILENO) {
+            close(fd);
+        }
+        errno = error;
+        return false;
+    }
+
+    // the first backtrace() loads libgcc_s, which allocates, so get that done now
+    void * frames[1];
+    backtrace(frames, 1);
+
+    dump_fd = fd;
+    struct sigaction action {};
+    action.sa_sigaction = on_crash;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    // blocked while dumping: a fault inside the handler itself then kills the process instead of waiting forever
+    sigemptyset(&action.sa_mask);
+    for (const int signal : handled_signals) {
+        sigaddset(&action.sa_mask, signal);
+    }
+    for (const int signal : handled_signals) {
+        sigaction(signal, &action, nullptr);
+    }
+
+    return true;
+}
+
+class crash_handler_init_t
+{
+public:
+    crash_handler_init_t()
+    {
+        if (const char * path = std::getenv("CPPCOWOVERLAY_CRASH_DUMP"); path != nullptr && *path != '\0')
+        {
+            if (!debug::crash_handler::install(path)) {
+                std::cerr << "Cannot install the crash handler for " << path << ": " << std::strerror(errno) << std::endl;
+            }
+        }
+    }
+} crash_handler_init;
@@ -19,105 +19,150 @@
  */
 
 #include <atomic>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 #include <execinfo.h>
 #include <sstream>
-#include <regex>
 #include <cxxabi.h>
 #include <iostream>
-#include <ranges>
+#include <algorithm>
 #include "color.h"
 #include "execute_command.h"
 #include "error.h"
 #include "rstring.h"
+#include "symbolizer.h"
 
 require_back_trace_t require_back_trace;
 #define MAX_STACK_FRAMES (64)
 
-std::string demangle(const char* mangled)
+// demangles into a buffer kept per thread; the result is valid until the next call
+std::string_view demangle(const std::string_view mangled)
 {
+    thread_local std::string name;
+    thread_local char * buffer = nullptr;
+    thread_local std::size_t buffer_size = 0;
+
+    name.assign(mangled); // __cxa_demangle needs it NUL terminated
     int status = 0;
-    char* dem = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
-    std::string result = (status == 0 && dem) ? dem : mangled;
-    std::free(dem);
-    return result;
+    if (char * result = abi::__cxa_demangle(name.c_str(), buffer, &buffer_size, &status); status == 0 && result != nullptr)
+    {
+        buffer = result; // may have been grown with realloc()
+        return buffer;
+    }
+
+    return name;
 }
 
-typedef std::vector < std::pair<std::string, void*> > backtrace_info;
-backtrace_info obtain_stack_frame()
+// first occurrence of open, up to and including the last occurrence of close after it, is removed
+void erase_span(std::string & name, const std::string_view open, const std::string_view close)
 {
-    backtrace_info result;
-    void* buffer[MAX_STACK_FRAMES] = {};
-    const int frames = backtrace(buffer, MAX_STACK_FRAMES);
-
-    char** symbols = backtrace_symbols(buffer, frames);
-    if (symbols == nullptr) {
-        return backtrace_info {};
+    const std::size_t begin = name.find(open);
+    if (begin == std::string::npos) {
+        return;
     }
 
-    for (int i = 1; i < frames; ++i) {
-        result.emplace_back(symbols[i], buffer[i]);
+    const std::size_t end = name.rfind(close);
+    if (end == std::string::npos || end < begin + open.size()) {
+        return;
     }
 
-    free(symbols);
-    return result;
+    name.erase(begin, end + close.size() - begin);
 }
 
 // fast backtrace
-std::string backtrace_level_1()
+std::string backtrace_level_1(void * const * buffer, const int count)
 {
-    std::stringstream ss;
-    const backtrace_info frames = obtain_stack_frame();
-    int i = 0;
+    std::string out;
+    char** symbols = backtrace_symbols(buffer, count);
+    if (symbols == nullptr) {
+        return out;
+    }
 
+    out.reserve(count * 128);
 #if DEBUG
-    auto trim_sym = [](std::string name)->std::string
-    {
-        name = std::regex_replace(name, std::regex(R"(\(.*\))"), "");
-        name = std::regex_replace(name, std::regex(R"(\[abi\:.*\])"), "");
-        name = std::regex_replace(name, std::regex(R"(std\:\:.*\:\:)"), "");
-        return name;
-    };
-
-    auto get_pair = [](const std::string & name)->std::pair<std::string, std::string>
+    std::string name;
+#endif
+    for (int i = 0; i < count; i++)
     {
-        const std::regex pattern(R"((.*)\((.*)(\+0x.*)\)\s\[.*\])");
-        if (std::smatch matches; std::regex_search(name, matches, pattern)) {
-            if (matches.size() == 4) {
-                return std::make_pair(matches[1].str(),
-                    matches[2].str().empty() ? matches[3].str() : demangle(matches[2].str().c_str()));
+        const std::string_view symbol = symbols[i];
+        out += color::color(0,4,1);
+#if DEBUG
+        // "path(mangled+0xoffset) [0xaddress]", the name part may be empty
+        std::string_view path;
+        name.clear();
+        const std::size_t address = symbol.rfind(" [");
+        const std::size_t open = address == std::string_view::npos ? address : symbol.rfind('(', address);
+        const std::size_t plus = open == std::string_view::npos ? open : symbol.find("+0x", open);
+        if (plus != std::string_view::npos && address > 0 && symbol[address - 1] == ')' && plus < address)
+        {
+            path = symbol.substr(0, open);
+            const std::string_view mangled = symbol.substr(open + 1, plus - open - 1);
+            if (mangled.empty()) {
+                name.assign(symbol.substr(plus, address - 1 - plus));
+            } else {
+                name.assign(demangle(mangled));
             }
         }
+        else {
+            name.assign(symbol);
+        }
 
-        return std::make_pair("", name);
-    };
-#endif
+        // drop arguments, ABI tags and namespaces of the standard library
+        erase_span(name, "(", ")");
+        erase_span(name, "[abi:", "]");
+        erase_span(name, "std::", "::");
 
-    for (const auto &symbol_name: frames | std::views::keys)
-    {
-#if DEBUG
-        const auto [path, name] = get_pair(symbol_name);
-        ss  << color::color(0,4,1) << "    Frame " << color::color(5,2,1) << "#" << i++ << " "
-            << std::hex << color::color(2,4,5) << path
-            << ": " << color::color(1,5,5) << trim_sym(name) << color::no_color() << "\n";
+        out += "    Frame ";
+        out += color::color(5,2,1);
+        out += "#";
+        out += std::to_string(i);
+        out += " ";
+        out += color::color(2,4,5);
+        out += path;
+        out += ": ";
+        out += color::color(1,5,5);
+        out += name;
 #else
-        ss  << color::color(0,4,1) << " Frame " << color::color(5,2,1) << "#" << i++ << " "
-            << symbol_name << color::no_color() << "\n";
+        out += " Frame ";
+        out += color::color(5,2,1);
+        out += "#";
+        out += std::to_string(i);
+        out += " ";
+        out += symbol;
 #endif
+        out += color::no_color();
+        out += "\n";
     }
 
-    return ss.str();
+    free(symbols);
+    return out;
+}
+
+// one addr2line per object, kept running between backtraces: it answers an address per line on stdin
+cmd_coprocess & addr2line(const std::string & object)
+{
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::unique_ptr<cmd_coprocess>> coprocesses;
+    std::lock_guard lock(mutex);
+    auto & coprocess = coprocesses[object];
+    if (!coprocess)
+    {
+        const char * env_addr2line_loc_override = getenv("ADDR2LINE_LOC_OVERRIDE");
+        coprocess = std::make_unique<cmd_coprocess>(
+            env_addr2line_loc_override == nullptr ? "/usr/bin/addr2line" : env_addr2line_loc_override,
+            std::vector<std::string> { "--demangle", "-f", "-p", "-a", "-e", object });
+    }
+    return *coprocess;
 }
 
 // slow backtrace, with better trace info
-std::string backtrace_level_2()
+std::string backtrace_level_2(void * const * buffer, const int count)
 {
 #if DEBUG
     std:: stringstream ss;
-    const auto frames = obtain_stack_frame();
+    const auto frames = debug::symbolizer::resolve(buffer, count);
     int i = 0;
-    const std::regex pattern(R"(([^\(]+)\(([^\)]*)\) \[([^\]]+)\])");
-    std::smatch matches;
 
     struct traced_info
     {
@@ -127,18 +172,15 @@ std::string backtrace_level_2()
 
     auto generate_addr2line_trace_info = [](const std::string & executable_path, const std::string& address)->traced_info
     {
-        const char * env_addr2line_loc_override = getenv("ADDR2LINE_LOC_OVERRIDE");
-        auto [fd_stdout, fd_stderr, exit_status]
-            = exec_command((env_addr2line_loc_override == nullptr ? "/usr/bin/addr2line" : env_addr2line_loc_override),
-                "", "--demangle", "-f", "-p", "-a", "-e",
-                executable_path, address);
-
-        if (exit_status != 0)
+        auto response = addr2line(executable_path).request(address);
+        if (!response)
         {
-            std::cerr << "Error when executing addr2line: " << fd_stderr << (!fd_stderr.empty() && fd_stderr.back() == '\n' ? "" : "\n") << std::flush;
+            std::cerr << "Error when executing addr2line: " << response.error().text() << "\n" << std::flush;
             return {};
         }
 
+        std::string & fd_stdout = *response;
+
         std::string caller, path;
         if (const size_t pos = fd_stdout.find('/'); pos != std::string::npos) {
             caller = fd_stdout.substr(0, pos - 4);
@@ -156,33 +198,45 @@ std::string backtrace_level_2()
         return {.name = replace_all(fd_stdout, "\n", ""), .file = ""};
     };
 
-    for (const auto & [symbol, frame] : frames)
+    // addr2line is only consulted for frames without line information, and only if asked for
+    const char * env_addr2line_fallback = getenv("CPPCOWOVERLAY_BACKTRACE_ADDR2LINE");
+    const bool addr2line_fallback = env_addr2line_fallback != nullptr && std::string(env_addr2line_fallback) == "1";
+
+    for (int index = 0; index < count; index++)
     {
-        if (std::regex_search(symbol, matches, pattern) && matches.size() > 3)
+        const auto & frame = frames[index];
+        if (frame.object.empty())
         {
-            const std::string& executable_path = matches[1].str();
-            const std::string& traced_address = matches[2].str();
-            const std::string& traced_runtime_address = matches[3].str();
-            traced_info info;
-            if (traced_address.empty()) {
-                info = generate_addr2line_trace_info(executable_path, traced_runtime_address);
-            } else {
+            ss << "No trace information for " << std::hex << buffer[index] << "\n";
+            continue;
+        }
 
-                info = generate_addr2line_trace_info(executable_path, traced_address);
-            }
+        traced_info info { .name = frame.function, .file = "" };
+        if (!frame.file.empty()) {
+            info.file = frame.file + ":" + std::to_string(frame.line);
+        }
+        else if (addr2line_fallback)
+        {
+            std::stringstream offset;
+            offset << "0x" << std::hex << frame.offset - 1;
+            info = generate_addr2line_trace_info(frame.object, offset.str());
+        }
 
-            ss  << color::color(0,4,1) << "    Frame " << color::color(5,2,1) << "#" << i++ << " "
-                << std::hex << color::color(2,4,5) << frame
-                << ": " << color::color(1,5,5) << info.name << color::no_color() << "\n";
-            if (!info.file.empty())
-                ss << "          " << color::color(0,1,5) << info.file << color::no_color() << "\n";
-        } else {
-            ss << "No trace information for " << std::hex << frame << "\n";
+        if (info.name.empty()) {
+            info.name = "?? (" + frame.object + ")";
         }
+
+        ss  << color::color(0,4,1) << "    Frame " << color::color(5,2,1) << "#" << std::dec << i++ << " "
+            << std::hex << color::color(2,4,5) << buffer[index]
+            << ": " << color::color(1,5,5) << info.name << color::no_color() << "\n";
+        if (!info.file.empty())
+            ss << "          " << color::color(0,1,5) << info.file << color::no_color() << "\n";
     }
 
     return ss.str();
 #else
+    (void)buffer;
+    (void)count;
     return "!!! Backtrace level 2 not available for release build !!!\n";
 #endif
 
@@ -208,21 +262,65 @@ class g_pre_defined_level_init_t
     }
 } g_pre_defined_level_init;
 
-std::string backtrace()
+std::string render_backtrace(void * const * frames, const int count)
 {
     switch (g_pre_defined_level)
     {
-        case 1: return backtrace_level_1();
-        case 2: return backtrace_level_2();
-        default: return backtrace_level_1();
+        case 1: return backtrace_level_1(frames, count);
+        case 2: return backtrace_level_2(frames, count);
+        default: return backtrace_level_1(frames, count);
     }
 }
 
+// Raw return addresses taken at construction, turned into text on the first what()
+struct cppCowOverlayBaseErrorType::lazy_backtrace_t
+{
+    bool has_message = false;
+    void * frames[MAX_STACK_FRAMES] = {};
+    int frame_count = 0;
+    std::once_flag rendered_once;
+    std::string rendered;
+};
+
 cppCowOverlayBaseErrorType::cppCowOverlayBaseErrorType(const require_back_trace_t&)
-    : std::runtime_error(backtrace()) { }
+    : std::runtime_error(""), lazy_backtrace(std::make_shared<lazy_backtrace_t>())
+{
+    lazy_backtrace->frame_count = ::backtrace(lazy_backtrace->frames, MAX_STACK_FRAMES);
+}
 
 cppCowOverlayBaseErrorType::cppCowOverlayBaseErrorType(const require_back_trace_t&, const std::string &msg)
-    : std::runtime_error(color::color(5,0,0) + msg + "\n" + color::color(5,5,0)
-        + ">>> BACKTRACE INFORMATION:" + color::no_color() + "\n" +
-            backtrace()
-        +  color::color(5,5,0) + "<<< BACKTRACE INFORMATION END" + color::no_color()) { }
+    : std::runtime_error(msg), lazy_backtrace(std::make_shared<lazy_backtrace_t>())
+{
+    lazy_backtrace->has_message = true;
+    lazy_backtrace->frame_count = ::backtrace(lazy_backtrace->frames, MAX_STACK_FRAMES);
+}
+
+const char * cppCowOverlayBaseErrorType::what() const noexcept
+{
+    if (!lazy_backtrace) {
+        return std::runtime_error::what();
+    }
+
+    try
+    {
+        std::call_once(lazy_backtrace->rendered_once, [this]
+        {
+            const std::string trace = render_backtrace(lazy_backtrace->frames, lazy_backtrace->frame_count);
+            if (!lazy_backtrace->has_message)
+            {
+                lazy_backtrace->rendered = trace;
+                return;
+            }
+
+            lazy_backtrace->rendered = std::string(color::color(5,0,0)) + std::runtime_error::what() + "\n"
+                + std::string(color::color(5,5,0)) + ">>> BACKTRACE INFORMATION:" + std::string(color::no_color()) + "\n"
+                + trace
+                + std::string(color::color(5,5,0)) + "<<< BACKTRACE INFORMATION END" + std::string(color::no_color());
+        });
+    }
+    catch (...) {
+        return std::runtime_error::what(); // out of memory, the message alone has to do
+    }
+
+    return lazy_backtrace->rendered.c_str();
+}
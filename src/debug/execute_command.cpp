@@ -1,232 +1,1091 @@
 #include "execute_command.h"
+#include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <spawn.h>
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
 #include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <span>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
 /* Since pipes are unidirectional, we need three pipes:
    1. Parent writes to child's stdin
    2. Child writes to parent's stdout
    3. Child writes to parent's stderr
+
+   They belong to one call, so any number of threads can run commands at once. All of them
+   are created with O_CLOEXEC: a child started by another thread meanwhile must not inherit
+   them, or it would hold our pipes open (and our reads would never see EOF) until it exits.
 */
 
-#define NUM_PIPES           3
+namespace {
+    // Owns one file descriptor, so every early return closes whatever was opened so far
+    class file_descriptor_t
+    {
+        int fd = -1;
+
+    public:
+        file_descriptor_t() = default;
+        explicit file_descriptor_t(const int fd) : fd(fd) { }
+        file_descriptor_t(file_descriptor_t && other) noexcept : fd(std::exchange(other.fd, -1)) { }
+        file_descriptor_t & operator=(file_descriptor_t && other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                fd = std::exchange(other.fd, -1);
+            }
+            return *this;
+        }
+        ~file_descriptor_t() { reset(); }
+
+        [[nodiscard]] int get() const { return fd; }
+
+        int reset()
+        {
+            const int result = fd == -1 ? 0 : close(fd);
+            fd = -1;
+            return result;
+        }
+    };
+
+    /* Always in a pipe_t, read is the read end and write the write end */
+    struct pipe_t
+    {
+        file_descriptor_t read;
+        file_descriptor_t write;
+    };
+
+    bool make_pipe(pipe_t & pipe)
+    {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            return false;
+        }
+        pipe.read = file_descriptor_t(fds[0]);
+        pipe.write = file_descriptor_t(fds[1]);
+        return true;
+    }
+
+    // posix_spawn() starts the child with clone(CLONE_VM | CLONE_VFORK) in glibc: unlike fork(), nothing
+    // of our address space is copied, so the launch costs the same however large this process grows.
+    // The three fds become the child's stdin, stdout and stderr. Returns 0 or an error number.
+    int spawn(const std::string & cmd, const std::vector<std::string> & args,
+        const int stdin_fd, const int stdout_fd, const int stderr_fd, pid_t & pid)
+    {
+        std::vector<char *> argv;
+        argv.reserve(args.size() + 2);
+        argv.push_back(const_cast<char *>(cmd.c_str()));
+        for (const auto &arg : args) {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions;
+        int error = posix_spawn_file_actions_init(&actions);
+        if (error != 0) {
+            return error;
+        }
+
+        // a dup2 action clears O_CLOEXEC on the copy, or on fd itself if it already is the target,
+        // every other pipe end is closed by exec (O_CLOEXEC)
+        const int redirections[][2] = { { stdin_fd, STDIN_FILENO }, { stdout_fd, STDOUT_FILENO }, { stderr_fd, STDERR_FILENO } };
+        for (const auto & [fd, target] : redirections)
+        {
+            if (error == 0) {
+                error = posix_spawn_file_actions_adddup2(&actions, fd, target);
+            }
+        }
+
+        if (error == 0) {
+            error = posix_spawn(&pid, cmd.c_str(), &actions, nullptr, argv.data(), environ);
+        }
+        posix_spawn_file_actions_destroy(&actions);
+        return error;
+    }
+
+    // Blocks SIGPIPE for the calling thread while it writes to a child that may have exited already,
+    // so that shows up as EPIPE instead of killing the process. A SIGPIPE raised meanwhile is discarded.
+    class sigpipe_guard_t
+    {
+        sigset_t sigpipe {};
+        sigset_t previous_mask {};
+        bool was_pending = false;
+
+        [[nodiscard]] bool pending() const
+        {
+            sigset_t set;
+            sigpending(&set);
+            return sigismember(&set, SIGPIPE) == 1;
+        }
+
+    public:
+        sigpipe_guard_t()
+        {
+            sigemptyset(&sigpipe);
+            sigaddset(&sigpipe, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &sigpipe, &previous_mask);
+            was_pending = pending();
+        }
+
+        ~sigpipe_guard_t()
+        {
+            if (!was_pending && pending())
+            {
+                constexpr timespec no_wait {};
+                sigtimedwait(&sigpipe, nullptr, &no_wait);
+            }
+            pthread_sigmask(SIG_SETMASK, &previous_mask, nullptr);
+        }
+
+        sigpipe_guard_t(const sigpipe_guard_t &) = delete;
+        sigpipe_guard_t & operator=(const sigpipe_guard_t &) = delete;
+    };
+
+    bool set_non_blocking(const file_descriptor_t & fd)
+    {
+        const int flags = fcntl(fd.get(), F_GETFL);
+        return flags != -1 && fcntl(fd.get(), F_SETFL, flags | O_NONBLOCK) != -1;
+    }
+
+    // Where pump() puts what it reads from one of the child's outputs
+    struct sink_t
+    {
+        std::string * text = nullptr; // appended to, straight into the string's spare capacity
+        const std::function<void(std::string_view)> * stream = nullptr; // otherwise passed on chunk by chunk
+    };
+
+    enum class io_result_t { again, done, failed };
+
+    // One read() of whatever is available, done at EOF. The caller closes fd.
+    io_result_t read_available(const file_descriptor_t & fd, const sink_t & sink, std::string & error)
+    {
+        constexpr std::size_t chunk_size = 64 * 1024; // the default pipe capacity
+        ssize_t count = 0;
+        if (sink.text != nullptr)
+        {
+            const std::size_t size = sink.text->size();
+            // the size argument of the callback is not reliable with libstdc++ 12, size is captured instead
+            sink.text->resize_and_overwrite(size + chunk_size, [&](char * data, std::size_t) {
+                count = read(fd.get(), data + size, chunk_size);
+                return size + static_cast<std::size_t>(std::max<ssize_t>(count, 0));
+            });
+        }
+        else
+        {
+            char buffer[chunk_size];
+            count = read(fd.get(), buffer, chunk_size);
+            if (count > 0 && sink.stream != nullptr && *sink.stream) {
+                (*sink.stream)(std::string_view(buffer, count));
+            }
+        }
+
+        if (count == 0) {
+            return io_result_t::done;
+        }
+        if (count == -1 && errno != EAGAIN && errno != EINTR)
+        {
+            error += std::string("read() failed: ") + std::strerror(errno) + "\n";
+            return io_result_t::failed;
+        }
+        return io_result_t::again;
+    }
+
+    // One writev() of the pieces of input from next on, advancing them in place. Done once everything
+    // is written, or the child closed its stdin (EPIPE, with SIGPIPE blocked). The caller closes fd.
+    io_result_t write_available(const file_descriptor_t & fd, const std::span<iovec> input, std::size_t & next,
+        std::string & error)
+    {
+        const auto pieces = static_cast<int>(std::min<std::size_t>(input.size() - next, IOV_MAX));
+        const ssize_t count = writev(fd.get(), input.data() + next, pieces);
+        if (count == -1)
+        {
+            if (errno == EPIPE) {
+                return io_result_t::done;
+            }
+            if (errno == EAGAIN || errno == EINTR) {
+                return io_result_t::again;
+            }
+            error += std::string("write() to child stdin failed: ") + std::strerror(errno) + "\n";
+            return io_result_t::failed;
+        }
+
+        // step over what was written, the last piece reached may be done only in part
+        for (auto left = static_cast<std::size_t>(count); left > 0;)
+        {
+            iovec & piece = input[next];
+            const std::size_t step = std::min(left, piece.iov_len);
+            piece.iov_base = static_cast<char *>(piece.iov_base) + step;
+            piece.iov_len -= step;
+            left -= step;
+            next += piece.iov_len == 0;
+        }
+        return next == input.size() ? io_result_t::done : io_result_t::again;
+    }
+
+    // Feeds input to the child's stdin while draining its stdout and stderr, all three at once:
+    // handling them one after another deadlocks as soon as the child fills a pipe nobody reads yet.
+    // Every fd is closed once done with (or skipped if -1 already); a child that stops reading
+    // early just gets its input cut short. The pieces of input are advanced in place as they are written.
+    bool pump(file_descriptor_t & input_fd, std::span<iovec> input,
+        file_descriptor_t & stdout_fd, const sink_t & stdout_sink,
+        file_descriptor_t & stderr_fd, const sink_t & stderr_sink, std::string & error)
+    {
+        for (const file_descriptor_t * fd : { &input_fd, &stdout_fd, &stderr_fd })
+        {
+            if (fd->get() != -1 && !set_non_blocking(*fd))
+            {
+                error += std::string("fcntl() failed: ") + std::strerror(errno) + "\n";
+                return false;
+            }
+        }
+
+        if (input.empty()) {
+            input_fd.reset();
+        }
+
+        sigpipe_guard_t sigpipe_guard;
+        std::size_t next = 0; // first piece of input not completely written
+        while (input_fd.get() != -1 || stdout_fd.get() != -1 || stderr_fd.get() != -1)
+        {
+            // poll() skips negative fds, so finished pipes simply drop out
+            pollfd fds[] = {
+                { .fd = input_fd.get(), .events = POLLOUT, .revents = 0 },
+                { .fd = stdout_fd.get(), .events = POLLIN, .revents = 0 },
+                { .fd = stderr_fd.get(), .events = POLLIN, .revents = 0 },
+            };
+
+            if (poll(fds, std::size(fds), -1) == -1)
+            {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error += std::string("poll() failed: ") + std::strerror(errno) + "\n";
+                return false;
+            }
+
+            const io_result_t results[] = {
+                fds[0].revents != 0 ? write_available(input_fd, input, next, error) : io_result_t::again,
+                fds[1].revents != 0 ? read_available(stdout_fd, stdout_sink, error) : io_result_t::again,
+                fds[2].revents != 0 ? read_available(stderr_fd, stderr_sink, error) : io_result_t::again,
+            };
+
+            file_descriptor_t * pipes[] = { &input_fd, &stdout_fd, &stderr_fd };
+            for (std::size_t i = 0; i < std::size(results); i++)
+            {
+                if (results[i] == io_result_t::failed) {
+                    return false;
+                }
+                if (results[i] == io_result_t::done) {
+                    pipes[i]->reset();
+                }
+            }
+        }
+
+        return true;
+    }
+
+    inline std::string get_errno_message(const std::string &prefix = "") {
+        return prefix + std::strerror(errno);
+    }
 
-#define PARENT_WRITE_PIPE   0
-#define PARENT_READ_PIPE    1
-#define PARENT_ERR_PIPE     2
+    // Wait for child process to finish and record how it ended
+    void reap(const pid_t pid, cmd_status & status)
+    {
+        int wstatus;
+        pid_t waited;
+        while ((waited = waitpid(pid, &wstatus, 0)) == -1 && errno == EINTR) { }
+
+        if (waited == -1)
+        {
+            status.fd_stderr += get_errno_message("waitpid() failed: ");
+            status.exit_status = 1;
+        }
+        else if (WIFEXITED(wstatus)) {
+            status.exit_status = WEXITSTATUS(wstatus);
+        } else if (WIFSIGNALED(wstatus)) {
+            std::ostringstream oss;
+            oss << "Child terminated by signal " << WTERMSIG(wstatus) << "\n";
+            status.fd_stderr += oss.str();
+            status.exit_status = 1;
+        } else {
+            // Other cases like stopped or continued
+            status.fd_stderr += "Child process ended abnormally.\n";
+            status.exit_status = 1;
+        }
+    }
 
-int pipes[NUM_PIPES][2];
+    // The pieces of input for writev(), pointing into the caller's buffers. Empty pieces are left out.
+    std::vector<iovec> input_pieces(const cmd_input & input)
+    {
+        std::vector<iovec> pieces;
+        pieces.reserve(input.buffers.size() + 2);
+        const auto add = [&](const std::string_view piece)
+        {
+            if (!piece.empty()) {
+                pieces.push_back({ .iov_base = const_cast<char *>(piece.data()), .iov_len = piece.size() });
+            }
+        };
 
-/* Always in a pipe[], pipe[0] is for read and
-   pipe[1] is for write */
-#define READ_FD  0
-#define WRITE_FD 1
+        add(input.text);
+        for (const auto & buffer : input.buffers) {
+            add(buffer);
+        }
 
-#define PARENT_READ_FD   ( pipes[PARENT_READ_PIPE][READ_FD]   )
-#define PARENT_WRITE_FD  ( pipes[PARENT_WRITE_PIPE][WRITE_FD] )
-#define PARENT_ERR_FD    ( pipes[PARENT_ERR_PIPE][READ_FD]    )
+        if (input.ensure_newline
+            && (pieces.empty() || static_cast<const char *>(pieces.back().iov_base)[pieces.back().iov_len - 1] != '\n'))
+        {
+            add("\n");
+        }
+        return pieces;
+    }
 
-#define CHILD_READ_FD    ( pipes[PARENT_WRITE_PIPE][READ_FD]  )
-#define CHILD_WRITE_FD   ( pipes[PARENT_READ_PIPE][WRITE_FD]  )
-#define CHILD_ERR_FD     ( pipes[PARENT_ERR_PIPE][WRITE_FD]   )
+    // Shared by exec_command_() and exec_command_stream(). An output with a redirect fd other than -1
+    // gets no pipe, the child is handed that fd instead and the sink is not used. The same goes for
+    // an input fd or file, which replaces the stdin pipe.
+    void run(const std::string & cmd, const std::vector<std::string> & args, const cmd_input & input,
+        const sink_t & stdout_sink, const int stdout_redirect, const sink_t & stderr_sink, const int stderr_redirect,
+        cmd_status & status)
+    {
+        // one source only, a redirected stdin leaves no pipe to write text or buffers into
+        if ((input.fd != -1) + !input.file.empty() + (!input.text.empty() || !input.buffers.empty()) > 1)
+        {
+            status.fd_stderr += "cmd_input: text/buffers, fd and file are mutually exclusive";
+            status.exit_status = 1;
+            return;
+        }
 
-inline std::string get_errno_message(const std::string &prefix = "") {
-    return prefix + std::strerror(errno);
+        file_descriptor_t input_file;
+        int stdin_redirect = input.fd;
+        if (stdin_redirect == -1 && !input.file.empty())
+        {
+            input_file = file_descriptor_t(open(input.file.c_str(), O_RDONLY | O_CLOEXEC));
+            if (input_file.get() == -1)
+            {
+                status.fd_stderr += get_errno_message("open() " + input.file + " failed: ");
+                status.exit_status = 1;
+                return;
+            }
+            stdin_redirect = input_file.get();
+        }
+
+        // Initialize all required pipes
+        pipe_t child_stdin, child_stdout, child_stderr;
+        for (auto [pipe, redirected] : { std::pair(&child_stdin, stdin_redirect != -1), std::pair(&child_stdout, stdout_redirect != -1),
+            std::pair(&child_stderr, stderr_redirect != -1) })
+        {
+            if (!redirected && !make_pipe(*pipe)) {
+                status.fd_stderr += get_errno_message("pipe2() failed: ");
+                status.exit_status = 1;
+                return;
+            }
+        }
+
+        pid_t pid;
+        if (const int error = spawn(cmd, args, stdin_redirect != -1 ? stdin_redirect : child_stdin.read.get(),
+                stdout_redirect != -1 ? stdout_redirect : child_stdout.write.get(),
+                stderr_redirect != -1 ? stderr_redirect : child_stderr.write.get(), pid);
+            error != 0)
+        {
+            // Spawn failed (this includes a command that cannot be executed), the pipes are closed on return
+            status.fd_stderr += std::string("posix_spawn() failed: ") + std::strerror(error);
+            status.exit_status = 1;
+            return;
+        }
+
+        // Close unused pipe ends in the parent
+        input_file.reset();
+        child_stdin.read.reset();
+        child_stdout.write.reset();
+        child_stderr.write.reset();
+
+        // nothing to write if stdin was redirected: the check above rules out text and buffers, and
+        // ensure_newline has no effect then
+        std::vector<iovec> pieces;
+        if (stdin_redirect == -1) {
+            pieces = input_pieces(input);
+        }
+
+        // A failed pump closes the pipes, after which the child sees EOF or EPIPE and can be reaped as usual.
+        // The same goes for an exception from an output callback.
+        std::string pump_error;
+        bool pumped;
+        const auto close_pipes = [&] {
+            child_stdin.write.reset();
+            child_stdout.read.reset();
+            child_stderr.read.reset();
+        };
+        try {
+            pumped = pump(child_stdin.write, pieces, child_stdout.read, stdout_sink,
+                child_stderr.read, stderr_sink, pump_error);
+        } catch (...) {
+            close_pipes();
+            reap(pid, status);
+            throw;
+        }
+        close_pipes();
+
+        reap(pid, status);
+        if (!pumped)
+        {
+            status.fd_stderr += pump_error;
+            status.exit_status = 1;
+        }
+    }
 }
 
 cmd_status exec_command_(const std::string &cmd,
     const std::vector<std::string> &args, const std::string &input)
+{
+    return exec_command_(cmd, args, cmd_input { .text = input, .ensure_newline = true });
+}
+
+cmd_status exec_command_(const std::string & cmd, const std::vector<std::string> & args, const cmd_input & input)
 {
     cmd_status status = {"", "", 1}; // Default to failure
+    const sink_t stdout_sink { .text = &status.fd_stdout };
+    const sink_t stderr_sink { .text = &status.fd_stderr };
+    run(cmd, args, input, stdout_sink, -1, stderr_sink, -1, status);
+    return status;
+}
 
-    // Initialize all required pipes
-    for (auto & i : pipes)
+cmd_status exec_command_stream(const std::string & cmd, const std::vector<std::string> & args,
+    const cmd_input & input, const cmd_stream_options & options)
+{
+    cmd_status status = {"", "", 1}; // Default to failure
+    const sink_t stdout_sink { .stream = &options.out.on_data };
+    const sink_t stderr_sink { .stream = &options.err.on_data };
+    run(cmd, args, input, stdout_sink, options.out.fd, stderr_sink, options.err.fd, status);
+    return status;
+}
+
+struct cmd_executor::state_t
+{
+    struct job_t;
+
+    // What an epoll event points to: one fd of a running job, or the wakeup eventfd (job is nullptr)
+    struct watch_t
     {
-        if (pipe(i) == -1) {
-            status.fd_stderr += get_errno_message("pipe() failed: ");
-            status.exit_status = 1;
-            return status;
-        }
+        job_t * job = nullptr;
+        file_descriptor_t * fd = nullptr;
+    };
+
+    struct job_t
+    {
+        cmd_request request;
+        std::promise<cmd_status> promise;
+        cmd_status status = {"", "", 1}; // Default to failure
+        std::string error;               // failures of our own, reported after the child's stderr
+        pid_t pid = -1;
+        file_descriptor_t pidfd, input_fd, stdout_fd, stderr_fd;
+        watch_t watches[4];
+        std::vector<iovec> input;
+        std::size_t next = 0;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        int signals_sent = 0; // 1 after SIGTERM, 2 after SIGKILL
+        bool exited = false;
+        bool timed_out = false;
+    };
+
+    std::size_t max_running;
+    std::chrono::milliseconds kill_grace;
+
+    std::mutex mutex;
+    std::deque<std::unique_ptr<job_t>> queued;
+    bool stopping = false;
+
+    // everything below belongs to the reactor thread
+    std::vector<std::unique_ptr<job_t>> running;
+    file_descriptor_t epoll;
+    file_descriptor_t wakeup;
+    watch_t wakeup_watch;
+    std::thread reactor;
+
+    void wake() const
+    {
+        constexpr std::uint64_t one = 1;
+        [[maybe_unused]] const auto result = write(wakeup.get(), &one, sizeof(one));
     }
 
-    pid_t pid = fork();
-    if (pid < 0)
+    bool watch(job_t & job, const std::size_t slot, file_descriptor_t & fd, const std::uint32_t events)
     {
-        // Fork failed
-        status.fd_stderr += get_errno_message("fork() failed: ");
-        status.exit_status = 1;
-        // Close all pipes before returning
-        for (auto & pipe : pipes) {
-            close(pipe[READ_FD]);
-            close(pipe[WRITE_FD]);
+        job.watches[slot] = { .job = &job, .fd = &fd };
+        epoll_event event { .events = events, .data = { .ptr = &job.watches[slot] } };
+        return epoll_ctl(epoll.get(), EPOLL_CTL_ADD, fd.get(), &event) != -1;
+    }
+
+    // The child may still share the open file, in which case epoll would keep reporting it after close()
+    void unwatch(file_descriptor_t & fd) const
+    {
+        if (fd.get() != -1)
+        {
+            epoll_ctl(epoll.get(), EPOLL_CTL_DEL, fd.get(), nullptr);
+            fd.reset();
         }
-        return status;
     }
 
-    if (pid == 0)
+    // Spawn the child and register its pipes and pidfd. False if that failed, the job is finished then.
+    bool start(job_t & job)
     {
-        // Child process
+        pipe_t child_stdin, child_stdout, child_stderr;
+        for (pipe_t * pipe : { &child_stdin, &child_stdout, &child_stderr })
+        {
+            if (!make_pipe(*pipe)) {
+                job.error += get_errno_message("pipe2() failed: ");
+                return false;
+            }
+        }
 
-        // Redirect stdin
-        if (dup2(CHILD_READ_FD, STDIN_FILENO) == -1) {
-            perror("dup2 stdin");
-            exit(EXIT_FAILURE);
+        if (const int error = spawn(job.request.cmd, job.request.args,
+                child_stdin.read.get(), child_stdout.write.get(), child_stderr.write.get(), job.pid);
+            error != 0)
+        {
+            job.pid = -1;
+            job.error += std::string("posix_spawn() failed: ") + std::strerror(error);
+            return false;
         }
 
-        // Redirect stdout
-        if (dup2(CHILD_WRITE_FD, STDOUT_FILENO) == -1) {
-            perror("dup2 stdout");
-            exit(EXIT_FAILURE);
+        job.input_fd = std::move(child_stdin.write);
+        job.stdout_fd = std::move(child_stdout.read);
+        job.stderr_fd = std::move(child_stderr.read);
+        job.input = input_pieces(cmd_input { .text = job.request.input, .ensure_newline = job.request.ensure_newline });
+        if (job.input.empty()) {
+            job.input_fd.reset();
         }
 
-        // Redirect stderr
-        if (dup2(CHILD_ERR_FD, STDERR_FILENO) == -1) {
-            perror("dup2 stderr");
-            exit(EXIT_FAILURE);
+        job.pidfd = file_descriptor_t(static_cast<int>(syscall(SYS_pidfd_open, job.pid, 0)));
+        bool watched = job.pidfd.get() != -1 && watch(job, 3, job.pidfd, EPOLLIN);
+        for (auto [slot, fd, events] : { std::tuple(0, &job.input_fd, EPOLLOUT), std::tuple(1, &job.stdout_fd, EPOLLIN),
+            std::tuple(2, &job.stderr_fd, EPOLLIN) })
+        {
+            if (watched && fd->get() != -1) {
+                watched = set_non_blocking(*fd) && watch(job, slot, *fd, events);
+            }
         }
 
-        /* Close all pipe fds in the child */
-        for (auto & pipe : pipes)
+        if (!watched)
         {
-            close(pipe[READ_FD]);
-            close(pipe[WRITE_FD]);
+            job.error += get_errno_message("Cannot watch the child: ");
+            kill(job.pid, SIGKILL);
+            return false;
         }
 
-        // Build argv for execv
-        std::vector<char *> argv;
-        argv.push_back(const_cast<char *>(cmd.c_str()));
-        for (const auto &arg : args) {
-            argv.push_back(const_cast<char *>(arg.c_str()));
+        if (job.request.timeout.count() > 0) {
+            job.deadline = std::chrono::steady_clock::now() + job.request.timeout;
         }
-        argv.push_back(nullptr);
-        execv(cmd.c_str(), argv.data());
+        return true;
+    }
 
-        // If execv fails
-        perror("execv");
-        exit(EXIT_FAILURE);
+    // Read what is left in the output pipes and close them, for a child that was killed or ran past its
+    // timeout: whatever it started in the background may hold them open for much longer. The reads are
+    // bounded, such a background writer could otherwise keep the reactor thread here forever.
+    void drain(job_t & job)
+    {
+        constexpr int max_reads = 16; // 1 MiB in 64 KiB reads
+        unwatch(job.input_fd);
+        for (auto [fd, text] : { std::pair(&job.stdout_fd, &job.status.fd_stdout), std::pair(&job.stderr_fd, &job.status.fd_stderr) })
+        {
+            if (fd->get() != -1)
+            {
+                const sink_t sink { .text = text };
+                // errno stays 0 as long as there is something to read
+                errno = 0;
+                for (int reads = 0; reads < max_reads && read_available(*fd, sink, job.error) == io_result_t::again
+                    && errno == 0; reads++) { }
+                unwatch(*fd);
+            }
+        }
     }
-    else
+
+    void handle(const watch_t & watch)
     {
-        // Parent process
-        // Close unused pipe ends in the parent
-        close(CHILD_READ_FD);
-        close(CHILD_WRITE_FD);
-        close(CHILD_ERR_FD);
+        job_t & job = *watch.job;
+        if (watch.fd->get() == -1) { // closed by an earlier event of the same batch
+            return;
+        }
+
+        if (watch.fd == &job.pidfd)
+        {
+            job.exited = true;
+            unwatch(job.pidfd);
+            if (job.signals_sent > 0) {
+                drain(job);
+            }
+            return;
+        }
+
+        const io_result_t result = watch.fd == &job.input_fd
+            ? write_available(job.input_fd, job.input, job.next, job.error)
+            : read_available(*watch.fd, { .text = watch.fd == &job.stdout_fd ? &job.status.fd_stdout : &job.status.fd_stderr },
+                job.error);
+        if (result != io_result_t::again) {
+            unwatch(*watch.fd);
+        }
+    }
+
+    // SIGTERM at the deadline, SIGKILL a grace period later. A child that exited already may have left
+    // something behind that holds its output open, the pipes are cut at the deadline then.
+    void enforce_deadlines(const std::chrono::steady_clock::time_point now)
+    {
+        for (const auto & job : running)
+        {
+            if (now < job->deadline) {
+                continue;
+            }
 
-        // Set the write end of the stdin pipe to non-blocking to handle potential write errors
-        // fcntl(PARENT_WRITE_FD, F_SETFL, O_NONBLOCK); // Optional: Depending on requirements
+            job->timed_out = true;
+            if (job->exited)
+            {
+                drain(*job);
+                job->deadline = std::chrono::steady_clock::time_point::max();
+                continue;
+            }
 
-        // Write to child's stdin
-        ssize_t total_written = 0;
-        auto input_size = static_cast<ssize_t>(input.size());
-        const char *input_cstr = input.c_str();
-        ssize_t bytes_to_write = input_size;
+            const bool terminate = job->signals_sent == 0;
+            // through the pidfd, so a recycled pid can never be hit (glibc 2.36 has no usable C++ wrappers for these)
+            syscall(SYS_pidfd_send_signal, job->pidfd.get(), terminate ? SIGTERM : SIGKILL, nullptr, 0);
+            job->signals_sent++;
+            job->deadline = terminate ? now + kill_grace : std::chrono::steady_clock::time_point::max();
+        }
+    }
 
-        // Ensure input ends with a newline
-        std::string modified_input = input;
-        if (modified_input.empty() || modified_input.back() != '\n')
+    void finish(job_t & job)
+    {
+        for (file_descriptor_t * fd : { &job.pidfd, &job.input_fd, &job.stdout_fd, &job.stderr_fd }) {
+            unwatch(*fd);
+        }
+
+        if (job.pid != -1) {
+            reap(job.pid, job.status);
+        }
+
+        if (job.timed_out)
         {
-            modified_input += "\n";
-            input_cstr = modified_input.c_str();
-            bytes_to_write = static_cast<ssize_t>(modified_input.size());
+            job.status.fd_stderr += "Command timed out after " + std::to_string(job.request.timeout.count()) + " ms\n";
+            job.status.exit_status = 1;
         }
 
-        while (total_written < bytes_to_write)
+        if (!job.error.empty() || job.pid == -1)
         {
-            ssize_t written = write(PARENT_WRITE_FD, input_cstr + total_written, bytes_to_write - total_written);
-            if (written == -1)
+            job.status.fd_stderr += job.error;
+            job.status.exit_status = 1;
+        }
+        job.promise.set_value(std::move(job.status));
+    }
+
+    // milliseconds until the nearest deadline, -1 for none
+    [[nodiscard]] int next_timeout(const std::chrono::steady_clock::time_point now) const
+    {
+        auto nearest = std::chrono::steady_clock::time_point::max();
+        for (const auto & job : running) {
+            nearest = std::min(nearest, job->deadline);
+        }
+
+        if (nearest == std::chrono::steady_clock::time_point::max()) {
+            return -1;
+        }
+        const auto left = std::chrono::ceil<std::chrono::milliseconds>(nearest - now).count();
+        return static_cast<int>(std::clamp<decltype(left)>(left, 0, INT_MAX));
+    }
+
+    void run()
+    {
+        // writes to children that exited already fail with EPIPE instead of raising SIGPIPE
+        sigset_t sigpipe;
+        sigemptyset(&sigpipe);
+        sigaddset(&sigpipe, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+        epoll_event events[64];
+        while (true)
+        {
+            std::vector<std::unique_ptr<job_t>> starting;
             {
-                if (errno == EINTR)
-                    continue; // Retry on interrupt
-                else {
-                    status.fd_stderr += get_errno_message("write() to child stdin failed: ");
-                    status.exit_status = 1;
-                    return status;
+                std::lock_guard lock(mutex);
+                while (!queued.empty() && running.size() + starting.size() < max_running)
+                {
+                    starting.push_back(std::move(queued.front()));
+                    queued.pop_front();
+                }
+
+                if (stopping && queued.empty() && running.empty() && starting.empty()) {
+                    return;
+                }
+            }
+
+            for (auto & job : starting)
+            {
+                if (start(*job)) {
+                    running.push_back(std::move(job));
+                } else {
+                    finish(*job);
                 }
             }
 
-            total_written += written;
+            const int count = epoll_wait(epoll.get(), events, std::size(events), next_timeout(std::chrono::steady_clock::now()));
+            for (int i = 0; i < count; i++)
+            {
+                const auto * watch = static_cast<const watch_t *>(events[i].data.ptr);
+                if (watch->job == nullptr)
+                {
+                    std::uint64_t value;
+                    [[maybe_unused]] const auto result = read(wakeup.get(), &value, sizeof(value));
+                    continue;
+                }
+                handle(*watch);
+            }
+
+            enforce_deadlines(std::chrono::steady_clock::now());
+            std::erase_if(running, [this](const std::unique_ptr<job_t> & job)
+            {
+                const bool done = job->exited && job->input_fd.get() == -1
+                    && job->stdout_fd.get() == -1 && job->stderr_fd.get() == -1;
+                if (done) {
+                    finish(*job);
+                }
+                return done;
+            });
         }
+    }
+};
+
+cmd_executor::cmd_executor(const std::size_t max_running, const std::chrono::milliseconds kill_grace)
+    : state(std::make_unique<state_t>())
+{
+    state->max_running = max_running != 0 ? max_running : std::max(1u, std::thread::hardware_concurrency());
+    state->kill_grace = kill_grace;
+    state->epoll = file_descriptor_t(epoll_create1(EPOLL_CLOEXEC));
+    state->wakeup = file_descriptor_t(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    cow_assert_wm(state->epoll.get() != -1 && state->wakeup.get() != -1, cmd_executor_error,
+        get_errno_message("Cannot set up the reactor: "));
+
+    epoll_event event { .events = EPOLLIN, .data = { .ptr = &state->wakeup_watch } };
+    cow_assert_wm(epoll_ctl(state->epoll.get(), EPOLL_CTL_ADD, state->wakeup.get(), &event) != -1,
+        cmd_executor_error, get_errno_message("Cannot set up the reactor: "));
+    state->reactor = std::thread([this] { state->run(); });
+}
+
+cmd_executor::~cmd_executor()
+{
+    {
+        std::lock_guard lock(state->mutex);
+        state->stopping = true;
+    }
+    state->wake();
+    state->reactor.join();
+}
 
-        // Optionally close the write end if no more input is sent
-        if (close(PARENT_WRITE_FD) == -1)
+std::future<cmd_status> cmd_executor::submit(cmd_request request)
+{
+    auto job = std::make_unique<state_t::job_t>();
+    job->request = std::move(request);
+    auto future = job->promise.get_future();
+    {
+        std::lock_guard lock(state->mutex);
+        state->queued.push_back(std::move(job));
+    }
+    state->wake();
+    return future;
+}
+
+std::vector<std::future<cmd_status>> cmd_executor::submit(std::vector<cmd_request> batch)
+{
+    std::vector<std::future<cmd_status>> futures;
+    futures.reserve(batch.size());
+    {
+        std::lock_guard lock(state->mutex);
+        for (auto & request : batch)
         {
-            status.fd_stderr += get_errno_message("close() PARENT_WRITE_FD failed: ");
-            status.exit_status = 1;
-            return status;
+            auto job = std::make_unique<state_t::job_t>();
+            job->request = std::move(request);
+            futures.push_back(job->promise.get_future());
+            state->queued.push_back(std::move(job));
         }
+    }
+    state->wake();
+    return futures;
+}
 
-        // Function to read all data from a file descriptor
-        auto read_all = [&](int fd, std::string &output) -> bool
+struct cmd_coprocess::state_t
+{
+    std::string cmd;
+    std::vector<std::string> args;
+    framing frames;
+    std::chrono::milliseconds idle_timeout;
+    std::chrono::milliseconds response_timeout;
+    static constexpr std::chrono::milliseconds stop_grace = std::chrono::seconds(1);
+
+    std::mutex mutex;
+    std::condition_variable activity;
+    pid_t pid = -1;
+    file_descriptor_t input_fd;
+    file_descriptor_t output_fd;
+    std::string received; // read ahead of the frames handed out so far
+    std::chrono::steady_clock::time_point last_used;
+    bool stopping = false;
+    std::thread idle_reaper;
+
+    enum class reply_t
+    {
+        complete,
+        child_gone,     // EOF or EPIPE, a fresh child may do better
+        timed_out,
+    };
+
+    [[nodiscard]] bool running() const { return pid != -1; }
+
+    // Waits for events on fd, false once deadline has passed. Errors and hang-ups count as ready,
+    // the read or write that follows reports them.
+    static bool wait_ready(const file_descriptor_t & fd, const short events,
+        const std::chrono::steady_clock::time_point deadline)
+    {
+        for (;;)
         {
-            char buffer[4096];
-            ssize_t count;
-            while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
-                output.append(buffer, count);
+            int timeout = -1;
+            if (deadline != std::chrono::steady_clock::time_point::max())
+            {
+                const auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now());
+                if (left.count() <= 0) {
+                    return false;
+                }
+                timeout = static_cast<int>(std::min<std::chrono::milliseconds::rep>(left.count(), INT_MAX));
             }
 
-            if (count == -1) {
-                output += get_errno_message("read() failed: ");
-                return false;
+            pollfd entry { .fd = fd.get(), .events = events, .revents = 0 };
+            if (const int ready = poll(&entry, 1, timeout); ready > 0 || (ready == -1 && errno != EINTR)) {
+                return true;
             }
-            return true;
-        };
+        }
+    }
+
+    cow_expected<void> start()
+    {
+        pipe_t child_stdin, child_stdout;
+        for (pipe_t * pipe : { &child_stdin, &child_stdout }) {
+            cow_check_wm(make_pipe(*pipe), cmd_coprocess_error, get_errno_message("pipe2() failed: "));
+        }
 
-        // Read from child's stdout
-        if (!read_all(PARENT_READ_FD, status.fd_stdout))
+        const int error = spawn(cmd, args, child_stdin.read.get(), child_stdout.write.get(), STDERR_FILENO, pid);
+        if (error != 0)
         {
-            status.fd_stderr += get_errno_message("read_all() failed: ");
-            status.exit_status = 1;
-            return status;
+            pid = -1;
+            return cmd_coprocess_error::error("posix_spawn() failed for " + cmd + ": " + std::strerror(error));
         }
 
-        // Read from child's stderr
-        if (!read_all(PARENT_ERR_FD, status.fd_stderr))
+        input_fd = std::move(child_stdin.write);
+        output_fd = std::move(child_stdout.read);
+        received.clear();
+
+        // non-blocking, so a helper that hangs cannot hold the calling thread past response_timeout
+        if (!set_non_blocking(input_fd) || !set_non_blocking(output_fd))
         {
-            status.fd_stderr += get_errno_message("read_all() failed: ");
-            status.exit_status = 1;
-            return status;
+            const std::string message = get_errno_message("fcntl() failed: ");
+            stop();
+            return cmd_coprocess_error::error(message);
         }
+        return {};
+    }
 
-        // Close the read ends
-        if (close(PARENT_READ_FD) == -1)
+    // Closing stdin is enough for most helpers, SIGTERM takes care of the rest and SIGKILL of those that
+    // ignore it. Called with the mutex held, so the wait for the child is bounded.
+    void stop()
+    {
+        input_fd.reset();
+        output_fd.reset();
+        if (!running()) {
+            return;
+        }
+
+        const file_descriptor_t pidfd(static_cast<int>(syscall(SYS_pidfd_open, pid, 0)));
+        if (pidfd.get() == -1) {
+            kill(pid, SIGKILL); // nothing to wait on with a timeout
+        }
+        else
         {
-            status.fd_stderr += get_errno_message("close() PARENT_READ_FD failed: ");
-            status.exit_status = 1;
-            return status;
+            syscall(SYS_pidfd_send_signal, pidfd.get(), SIGTERM, nullptr, 0);
+            if (!wait_ready(pidfd, POLLIN, std::chrono::steady_clock::now() + stop_grace)) {
+                syscall(SYS_pidfd_send_signal, pidfd.get(), SIGKILL, nullptr, 0);
+            }
         }
 
-        if (close(PARENT_ERR_FD) == -1)
+        cmd_status ignored;
+        reap(pid, ignored);
+        pid = -1;
+    }
+
+    reply_t send(const std::string_view message, const std::chrono::steady_clock::time_point deadline)
+    {
+        std::vector<iovec> pieces;
+        auto size = static_cast<std::uint32_t>(message.size()); // checked by request()
+        if (frames == framing::line) {
+            pieces = input_pieces(cmd_input { .text = message, .ensure_newline = true });
+        } else {
+            pieces = {
+                { .iov_base = &size, .iov_len = sizeof(size) },
+                { .iov_base = const_cast<char *>(message.data()), .iov_len = message.size() },
+            };
+        }
+
+        // EPIPE (a dead child) counts as done too, hence the check of next
+        sigpipe_guard_t sigpipe_guard;
+        std::string error;
+        std::size_t next = 0;
+        io_result_t result;
+        while ((result = write_available(input_fd, pieces, next, error)) == io_result_t::again)
         {
-            status.fd_stderr += get_errno_message("close() PARENT_ERR_FD failed: ");
-            status.exit_status = 1;
-            return status;
+            if (!wait_ready(input_fd, POLLOUT, deadline)) {
+                return reply_t::timed_out;
+            }
         }
+        return result == io_result_t::done && next == pieces.size() ? reply_t::complete : reply_t::child_gone;
+    }
 
-        // Wait for child process to finish
-        int wstatus;
-        if (waitpid(pid, &wstatus, 0) == -1)
+    // Length of the first complete frame in received, including its delimiter or size, 0 if there is none yet
+    [[nodiscard]] std::size_t frame_length() const
+    {
+        if (frames == framing::line)
         {
-            status.fd_stderr += get_errno_message("waitpid() failed: ");
-            status.exit_status = 1;
-            return status;
+            const auto end = received.find('\n');
+            return end == std::string::npos ? 0 : end + 1;
         }
-        else
+
+        std::uint32_t size;
+        if (received.size() < sizeof(size)) {
+            return 0;
+        }
+        std::memcpy(&size, received.data(), sizeof(size));
+        return received.size() - sizeof(size) >= size ? sizeof(size) + size : 0;
+    }
+
+    reply_t receive(std::string & response, std::size_t count, const std::chrono::steady_clock::time_point deadline)
+    {
+        std::string error;
+        const sink_t sink { .text = &received };
+        while (count > 0)
         {
-            if (WIFEXITED(wstatus)) {
-                status.exit_status = WEXITSTATUS(wstatus);
-            } else if (WIFSIGNALED(wstatus)) {
-                std::ostringstream oss;
-                oss << "Child terminated by signal " << WTERMSIG(wstatus) << "\n";
-                status.fd_stderr += oss.str();
-                status.exit_status = 1;
-            } else {
-                // Other cases like stopped or continued
-                status.fd_stderr += "Child process ended abnormally.\n";
-                status.exit_status = 1;
+            if (const std::size_t length = frame_length(); length != 0)
+            {
+                const std::size_t header = frames == framing::length ? sizeof(std::uint32_t) : 0;
+                response.append(received, header, length - header);
+                received.erase(0, length);
+                count--;
+                continue;
+            }
+
+            if (!wait_ready(output_fd, POLLIN, deadline)) {
+                return reply_t::timed_out;
+            }
+            if (read_available(output_fd, sink, error) != io_result_t::again) { // EOF: the child is gone
+                return reply_t::child_gone;
+            }
+        }
+        return reply_t::complete;
+    }
+
+    void reap_idle()
+    {
+        std::unique_lock lock(mutex);
+        while (!stopping)
+        {
+            if (!running())
+            {
+                activity.wait(lock);
+                continue;
+            }
+
+            const auto deadline = last_used + idle_timeout;
+            if (activity.wait_until(lock, deadline) == std::cv_status::timeout && running()
+                && std::chrono::steady_clock::now() >= last_used + idle_timeout)
+            {
+                stop();
             }
-            return status;
         }
     }
+};
+
+cmd_coprocess::cmd_coprocess(std::string cmd, std::vector<std::string> args, const framing frames,
+    const std::chrono::milliseconds idle_timeout, const std::chrono::milliseconds response_timeout)
+    : state(std::make_unique<state_t>())
+{
+    state->cmd = std::move(cmd);
+    state->args = std::move(args);
+    state->frames = frames;
+    state->idle_timeout = idle_timeout;
+    state->response_timeout = response_timeout;
+    if (idle_timeout.count() > 0) {
+        state->idle_reaper = std::thread([this] { state->reap_idle(); });
+    }
+}
+
+cmd_coprocess::~cmd_coprocess()
+{
+    {
+        std::lock_guard lock(state->mutex);
+        state->stopping = true;
+    }
+    state->activity.notify_all();
+    if (state->idle_reaper.joinable()) {
+        state->idle_reaper.join();
+    }
+    state->stop();
+}
+
+cow_expected<std::string> cmd_coprocess::request(const std::string_view message, const std::size_t responses)
+{
+    if (state->frames == framing::length && message.size() > std::numeric_limits<std::uint32_t>::max()) {
+        return cmd_coprocess_error::error("request of " + std::to_string(message.size())
+            + " bytes does not fit a length frame");
+    }
+
+    std::lock_guard lock(state->mutex);
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (!state->running()) {
+            cow_propagate(state->start());
+        }
+
+        const auto deadline = state->response_timeout.count() > 0
+            ? std::chrono::steady_clock::now() + state->response_timeout : std::chrono::steady_clock::time_point::max();
+        std::string response;
+        auto reply = state->send(message, deadline);
+        if (reply == state_t::reply_t::complete) {
+            reply = state->receive(response, responses, deadline);
+        }
+
+        if (reply == state_t::reply_t::complete)
+        {
+            state->last_used = std::chrono::steady_clock::now();
+            state->activity.notify_all();
+            return response;
+        }
+
+        // A helper that hangs would hang again. One that died (or quit on this request) is started
+        // again for one more try.
+        state->stop();
+        if (reply == state_t::reply_t::timed_out) {
+            return cmd_coprocess_error::error("no response from " + state->cmd + " within "
+                + std::to_string(state->response_timeout.count()) + " ms");
+        }
+    }
+
+    return cmd_coprocess_error::error("no response from " + state->cmd);
 }
@@ -0,0 +1,135 @@
+/* hex_dump.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include "hex_dump.h"
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+namespace {
+    constexpr std::size_t bytes_per_line = 16;
+    constexpr std::size_t offset_digits = 8;
+    constexpr std::size_t hex_column = offset_digits + 2;
+    constexpr char digits[] = "0123456789abcdef";
+
+    // where the two hex digits of byte i of a line go; the two groups of 8 are separated by an extra space
+    constexpr std::size_t hex_position(const std::size_t i) {
+        return hex_column + i * 3 + (i >= bytes_per_line / 2);
+    }
+
+    constexpr std::size_t ascii_column = hex_position(bytes_per_line) + 2;         // after "  |"
+    constexpr std::size_t line_length = ascii_column + bytes_per_line + 2;        // "|\n" included
+
+    // 16 bytes into 32 hex digits and 16 printable characters
+    void convert(const std::uint8_t * bytes, char * hex, char * ascii)
+    {
+#if defined(__SSE2__)
+        const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes));
+        const __m128i low_nibble = _mm_set1_epi8(0x0F);
+        const __m128i high = _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble);
+        const __m128i low = _mm_and_si128(input, low_nibble);
+
+        // nibble + '0', plus the distance to 'a' for nibbles above 9
+        const auto to_ascii = [](const __m128i nibble) {
+            const __m128i letter = _mm_cmpgt_epi8(nibble, _mm_set1_epi8(9));
+            return _mm_add_epi8(_mm_add_epi8(nibble, _mm_set1_epi8('0')),
+                _mm_and_si128(letter, _mm_set1_epi8('a' - '0' - 10)));
+        };
+        const __m128i high_ascii = to_ascii(high);
+        const __m128i low_ascii = to_ascii(low);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(hex), _mm_unpacklo_epi8(high_ascii, low_ascii));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(hex + 16), _mm_unpackhi_epi8(high_ascii, low_ascii));
+
+        // 0x20..0x7E stay, everything else (including 0x80 and up, negative as signed) becomes '.'
+        const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8(0x1F)),
+            _mm_cmplt_epi8(input, _mm_set1_epi8(0x7F)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(ascii), _mm_or_si128(_mm_and_si128(printable, input),
+            _mm_andnot_si128(printable, _mm_set1_epi8('.'))));
+#else
+        for (std::size_t i = 0; i < bytes_per_line; i++)
+        {
+            hex[i * 2] = digits[bytes[i] >> 4];
+            hex[i * 2 + 1] = digits[bytes[i] & 0x0F];
+            ascii[i] = bytes[i] >= 0x20 && bytes[i] < 0x7F ? static_cast<char>(bytes[i]) : '.';
+        }
+#endif
+    }
+
+    void put_offset(char * line, std::size_t offset)
+    {
+        for (std::size_t i = offset_digits; i > 0; i--)
+        {
+            line[i - 1] = digits[offset & 0x0F];
+            offset >>= 4;
+        }
+    }
+}
+
+void debug::hex_dump(std::string & out, const void * data, const std::size_t size)
+{
+    const auto * bytes = static_cast<const std::uint8_t *>(data);
+    char header[32];
+    const auto header_end = std::to_chars(header + 1, header + sizeof(header) - 8, size).ptr;
+    header[0] = '(';
+    std::memcpy(header_end, " bytes)", 7);
+    out.append(header, header_end + 7);
+    if (size == 0) {
+        return;
+    }
+
+    const std::size_t lines = (size + bytes_per_line - 1) / bytes_per_line;
+    const std::size_t start = out.size();
+    out.resize(start + 1 + lines * line_length);
+    char * cursor = out.data() + start;
+    *cursor++ = '\n';
+
+    for (std::size_t offset = 0; offset < size; offset += bytes_per_line)
+    {
+        const std::size_t count = std::min(bytes_per_line, size - offset);
+        std::uint8_t chunk[bytes_per_line] {};
+        const std::uint8_t * source = bytes + offset;
+        if (count < bytes_per_line) // never read past the end of the caller's buffer
+        {
+            std::memcpy(chunk, source, count);
+            source = chunk;
+        }
+
+        char hex[bytes_per_line * 2];
+        char * line = cursor;
+        std::memset(line, ' ', ascii_column);
+        put_offset(line, offset);
+        convert(source, hex, line + ascii_column);
+        for (std::size_t i = 0; i < count; i++) {
+            std::memcpy(line + hex_position(i), hex + i * 2, 2);
+        }
+
+        line[ascii_column - 1] = '|';
+        line[ascii_column + count] = '|';
+        line[ascii_column + count + 1] = '\n';
+        cursor = line + ascii_column + count + 2;
+    }
+
+    out.resize(cursor - out.data() - 1); // drop the last newline
+}
@@ -0,0 +1,94 @@
+/* json_log.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "json_log.h"
+
+void debug::json::put_string(std::string & out, const std::string_view str)
+{
+    constexpr char hex[] = "0123456789abcdef";
+    out += '"';
+    std::size_t plain = 0; // start of the run of characters that need no escaping
+    for (std::size_t i = 0; i < str.size(); i++)
+    {
+        const auto c = static_cast<unsigned char>(str[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        out.append(str.data() + plain, i - plain);
+        plain = i + 1;
+        switch (c)
+        {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+                break;
+        }
+    }
+    out.append(str.data() + plain, str.size() - plain);
+    out += '"';
+}
+
+debug::json::text_buffer_t & debug::json::text_stream_buffer()
+{
+    thread_local text_buffer_t buffer;
+    return buffer;
+}
+
+std::ostream & debug::json::text_stream()
+{
+    thread_local std::ostream stream(&text_stream_buffer());
+    return stream;
+}
+
+std::string & debug::json::record_buffer()
+{
+    thread_local std::string buffer;
+    return buffer;
+}
+
+void debug::json::begin_record(std::string & record, const call_site_t * site, const unsigned int level)
+{
+    constexpr std::string_view level_names[] = { "debug", "info", "warning", "error" };
+    char time_buffer[timestamp::max_length];
+    record += "{\"time\":";
+    put_string(record, timestamp::now(time_buffer));
+    record += ",\"level\":\"";
+    record += level_names[level < std::size(level_names) ? level : 1];
+    record += '"';
+    if (site != nullptr)
+    {
+        record += ",\"function\":";
+        put_string(record, site->function);
+        record += ",\"file\":";
+        put_string(record, site->file);
+        record += ",\"line\":";
+        put_number(record, site->line);
+    }
+    record += ",\"args\":[";
+}
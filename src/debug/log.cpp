@@ -19,22 +19,122 @@
  */
 
 #include "log.hpp"
-#include <regex>
+#include "log_file.h"
+#include "hex_dump.h"
 #include <ranges>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
 
 std::mutex debug::log_mutex;
 std::atomic_uint debug::filter_level = !!!DEBUG;
-unsigned int debug::log_level = 1;
-bool debug::endl_found_in_last_log = true;
+thread_local unsigned int debug::log_level = 1;
+thread_local bool debug::endl_found_in_last_log = true;
 std::ostream * debug::output = nullptr;
-std::string debug::strip_func_name(const std::string & name)
+int debug::output_fd = -1;
+thread_local std::ostream * debug::render_output = nullptr;
+std::atomic<debug::log_format_t> debug::log_format = log_format_t::text;
+
+void debug::_log_bytes(const void * data, const std::size_t size)
+{
+    thread_local std::string dump;
+    dump.clear();
+    hex_dump(dump, data, size);
+    render_output->write(dump.data(), static_cast<std::streamsize>(dump.size()));
+}
+
+void debug::thread_buffer_t::commit()
+{
+    std::string record = std::move(stream).str();
+    stream.str({});
+    if (record.empty()) {
+        return;
+    }
+
+    sink::commit(record, log_level);
+}
+
+debug::thread_buffer_t::~thread_buffer_t()
 {
-    const std::regex pattern(R"([\w]+ (.*)\(.*\))");
-    if (std::smatch matches; std::regex_match(name, matches, pattern) && matches.size() > 1) {
-        return matches[1];
+    commit(); // unfinished line of an exiting thread
+}
+
+debug::thread_buffer_t & debug::thread_buffer()
+{
+    thread_local thread_buffer_t buffer;
+    return buffer;
+}
+
+void debug::flush_suppressed()
+{
+    rate_limiter_t::drain_pending([](const call_site_t & site, const std::uint64_t count) {
+        log(&site, "suppressed ", count, " messages\n");
+    });
+}
+
+namespace {
+    // Reports the suppressed calls of rate limited call sites that went quiet, once per summary interval
+    // and a last time at exit. It logs from its own thread because by the time static objects are
+    // destroyed, the thread_local record buffers of the exiting thread are already gone.
+    class summary_reporter_t
+    {
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::once_flag started;
+        bool stopping = false;
+        std::thread worker;
+
+        void worker_main()
+        {
+            std::unique_lock lock(mutex);
+            for (bool last_round = false; !last_round;) // the last round runs even if stopped before the first
+            {
+                wakeup.wait_for(lock, std::chrono::seconds(debug::rate_limiter_t::summary_interval),
+                    [this] { return stopping; });
+                last_round = stopping;
+                lock.unlock();
+                debug::flush_suppressed();
+                lock.lock();
+            }
+        }
+
+    public:
+        void start()
+        {
+            std::call_once(started, [this] { worker = std::thread(&summary_reporter_t::worker_main, this); });
+        }
+
+        void stop()
+        {
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+            }
+            wakeup.notify_one();
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+
+        ~summary_reporter_t()
+        {
+            stop();
+        }
+    };
+
+    summary_reporter_t & summary_reporter()
+    {
+        static summary_reporter_t instance;
+        return instance;
     }
-    return name;
+}
+
+void debug::start_summary_reporter()
+{
+    summary_reporter().start();
 }
 
 class init_instance_t
@@ -42,6 +142,7 @@ class init_instance_t
 public:
     init_instance_t()
     {
+        summary_reporter(); // constructed before this instance, so it is still there in its destructor
         if (const auto log_level_env = std::getenv("LOG_LEVEL"); log_level_env != nullptr)
         {
             try {
@@ -57,6 +158,7 @@ public:
         }
 
         debug::output = &std::cout;
+        debug::output_fd = STDOUT_FILENO;
         if (const auto log_level_env = std::getenv("LOG_OUTPUT"); log_level_env != nullptr)
         {
             std::string log_output = log_level_env;
@@ -64,11 +166,105 @@ public:
             if (log_output == "stderr")
             {
                 debug::output = &std::cerr;
+                debug::output_fd = STDERR_FILENO;
             }
             else
             {
                 debug::output = &std::cout;
+                debug::output_fd = STDOUT_FILENO;
+            }
+        }
+
+        if (const auto log_dir_env = std::getenv("LOG_DIR"); log_dir_env != nullptr && *log_dir_env != '\0')
+        {
+            debug::log_file::options_t options { .directory = log_dir_env };
+            if (const auto segment_size_env = std::getenv("LOG_SEGMENT_SIZE"); segment_size_env != nullptr)
+            {
+                try {
+                    options.segment_size = std::stoull(segment_size_env, nullptr, 10);
+                } catch (...) {
+                }
+            }
+
+            if (const auto rotate_env = std::getenv("LOG_ROTATE_SECONDS"); rotate_env != nullptr)
+            {
+                try {
+                    options.rotate_interval = std::chrono::seconds(std::stoll(rotate_env, nullptr, 10));
+                } catch (...) {
+                }
+            }
+
+            if (!debug::log_file::open(options))
+            {
+                std::cerr << "Cannot open log directory " << options.directory << ": " << std::strerror(errno)
+                          << ", logging to " << (debug::output_fd == STDERR_FILENO ? "stderr" : "stdout") << std::endl;
+            }
+        }
+
+        if (const auto format_env = std::getenv("LOG_FORMAT"); format_env != nullptr)
+        {
+            std::string format = format_env;
+            std::ranges::transform(format, format.begin(), ::tolower);
+            if (format == "binary") {
+                debug::log_format = debug::log_format_t::binary;
+            } else if (format == "json") {
+                debug::log_format = debug::log_format_t::json;
+            }
+        }
+
+        if (const auto precision_env = std::getenv("LOG_TIME_PRECISION"); precision_env != nullptr)
+        {
+            std::string precision = precision_env;
+            std::ranges::transform(precision, precision.begin(), ::tolower);
+            if (precision == "ms") {
+                debug::timestamp::precision = debug::timestamp::precision_t::milliseconds;
+            } else if (precision == "us") {
+                debug::timestamp::precision = debug::timestamp::precision_t::microseconds;
+            }
+        }
+
+        if (const auto log_async_env = std::getenv("LOG_ASYNC"); log_async_env != nullptr)
+        {
+            std::string log_async = log_async_env;
+            std::ranges::transform(log_async, log_async.begin(), ::tolower);
+            if (log_async == "1" || log_async == "true" || log_async == "on" || log_async == "yes")
+            {
+                std::size_t capacity = debug::async::default_capacity;
+                if (const auto capacity_env = std::getenv("LOG_ASYNC_CAPACITY"); capacity_env != nullptr)
+                {
+                    try {
+                        capacity = std::stoul(capacity_env, nullptr, 10);
+                    } catch (...) {
+                        capacity = debug::async::default_capacity;
+                    }
+                }
+
+                auto policy = debug::async::overflow_policy_t::block;
+                if (const auto overflow_env = std::getenv("LOG_ASYNC_OVERFLOW"); overflow_env != nullptr)
+                {
+                    std::string overflow = overflow_env;
+                    std::ranges::transform(overflow, overflow.begin(), ::tolower);
+                    if (overflow == "drop") {
+                        policy = debug::async::overflow_policy_t::drop;
+                    } else if (overflow == "drop_oldest") {
+                        policy = debug::async::overflow_policy_t::drop_oldest;
+                    }
+                }
+
+                debug::async::start(capacity, policy);
             }
         }
     }
+
+    ~init_instance_t()
+    {
+        summary_reporter().stop(); // reports what is left before the writer below goes away
+
+        // flush whatever is still queued before the output streams go away
+        if (debug::async::enabled) {
+            debug::async::stop();
+        }
+
+        debug::log_file::close();
+    }
 } log_init_instance;
@@ -0,0 +1,386 @@
+/* log_file.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log_file.h"
+#include "log.hpp"
+
+std::atomic_bool debug::log_file::enabled = false;
+
+namespace {
+    struct segment_t
+    {
+        int fd = -1;
+        char * base = nullptr;
+        std::size_t size = 0;
+        std::size_t used = 0;
+        std::size_t synced = 0;
+        std::string path;
+    };
+
+    std::int64_t monotonic_seconds()
+    {
+        timespec now {};
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        return now.tv_sec;
+    }
+
+    class journal_t
+    {
+        debug::log_file::options_t options;
+
+        // guarded by debug::log_mutex, like every other write to the output
+        segment_t current;
+        std::int64_t rotate_deadline = 0;
+        std::string preamble;
+        bool failing = false;
+
+        // options.segment_size, grown so that the preamble never takes more than half of a segment
+        std::atomic<std::size_t> segment_size = 0;
+
+        // shared with the background thread
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::uint64_t sequence = 0;
+        std::optional<segment_t> spare;
+        std::vector<segment_t> retired;
+        bool stopping = false;
+        std::thread worker;
+
+        bool create(segment_t & segment)
+        {
+            segment.size = segment_size.load(std::memory_order_relaxed);
+            for (int attempt = 0; attempt < 1000; attempt++)
+            {
+                std::uint64_t number;
+                {
+                    std::lock_guard lock(mutex);
+                    number = sequence++;
+                }
+
+                char name[64];
+                std::snprintf(name, sizeof(name), "/journal-%d-%06llu.log", getpid(),
+                    static_cast<unsigned long long>(number));
+                segment.path = options.directory + name;
+                segment.fd = ::open(segment.path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+                if (segment.fd >= 0 || errno != EEXIST) {
+                    break;
+                }
+            }
+
+            if (segment.fd < 0) {
+                return false;
+            }
+
+            if (const int error = posix_fallocate(segment.fd, 0, static_cast<off_t>(segment.size)); error != 0)
+            {
+                ::close(segment.fd);
+                unlink(segment.path.c_str());
+                errno = error;
+                return false;
+            }
+
+            void * base = mmap(nullptr, segment.size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+            if (base == MAP_FAILED)
+            {
+                const int error = errno;
+                ::close(segment.fd);
+                unlink(segment.path.c_str());
+                errno = error;
+                return false;
+            }
+
+            segment.base = static_cast<char *>(base);
+            segment.used = 0;
+            segment.synced = 0;
+            return true;
+        }
+
+        // flush, then cut the file down to what was actually written
+        static void finalize(segment_t & segment)
+        {
+            if (segment.base == nullptr) {
+                return;
+            }
+
+            msync(segment.base, segment.size, MS_ASYNC);
+            munmap(segment.base, segment.size);
+            if (segment.used == 0) {
+                unlink(segment.path.c_str());
+            } else {
+                // best effort, a failure only leaves pre-allocated zeros at the end of the file
+                [[maybe_unused]] const int result = ftruncate(segment.fd, static_cast<off_t>(segment.used));
+            }
+            ::close(segment.fd);
+            segment = {};
+        }
+
+        // The journal is the log output, so its own failures go to stderr, once until it recovers.
+        // Caller holds debug::log_mutex.
+        void report(const char * what)
+        {
+            if (!failing)
+            {
+                failing = true;
+                std::fprintf(stderr, "Log journal in %s: %s: %s, log records are lost\n", options.directory.c_str(),
+                    what, std::strerror(errno));
+            }
+        }
+
+        // caller holds debug::log_mutex. The preamble is left out when the new segment continues a split record.
+        bool rotate(const bool with_preamble = true)
+        {
+            segment_t next;
+            {
+                std::lock_guard lock(mutex);
+                if (spare)
+                {
+                    // one made before the segments grew is too small for the preamble, it is dropped unused
+                    if (spare->size == segment_size.load(std::memory_order_relaxed)) {
+                        next = std::move(*spare);
+                    } else {
+                        retired.push_back(std::move(*spare));
+                    }
+                    spare.reset();
+                }
+            }
+
+            // background thread fell behind, do it here
+            if (next.base == nullptr && !create(next))
+            {
+                report("cannot create a new segment");
+                return false;
+            }
+            failing = false;
+
+            {
+                std::lock_guard lock(mutex);
+                retired.push_back(std::move(current));
+            }
+            current = std::move(next);
+            if (with_preamble) // fits, it takes at most half of the segment
+            {
+                std::memcpy(current.base, preamble.data(), preamble.size());
+                current.used = preamble.size();
+            }
+            rotate_deadline = monotonic_seconds() + options.rotate_interval.count();
+            wakeup.notify_one();
+            return true;
+        }
+
+        void sync_current()
+        {
+            char * base;
+            std::size_t from, to;
+            {
+                std::lock_guard lock(debug::log_mutex);
+                base = current.base;
+                from = current.synced;
+                to = current.used;
+                current.synced = to;
+            }
+
+            // only this thread unmaps segments, so base stays valid even if a writer rotated meanwhile
+            if (base != nullptr && to > from)
+            {
+                const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+                const std::size_t start = from / page * page;
+                msync(base + start, to - start, MS_ASYNC);
+            }
+        }
+
+        void worker_main()
+        {
+            std::unique_lock lock(mutex);
+            while (!stopping)
+            {
+                if (!spare)
+                {
+                    lock.unlock();
+                    segment_t segment;
+                    const bool created = create(segment);
+                    lock.lock();
+                    if (created) {
+                        spare = std::move(segment);
+                    }
+                }
+
+                auto finished = std::move(retired);
+                retired.clear();
+                lock.unlock();
+                for (auto & segment : finished) {
+                    finalize(segment);
+                }
+                sync_current();
+                lock.lock();
+
+                wakeup.wait_for(lock, options.sync_interval, [this] {
+                    return stopping || !retired.empty();
+                });
+            }
+        }
+
+    public:
+        bool open(const debug::log_file::options_t & journal_options)
+        {
+            options = journal_options;
+            options.segment_size = std::max<std::size_t>(options.segment_size, 4096);
+            segment_size = options.segment_size;
+            if (mkdir(options.directory.c_str(), 0755) == -1 && errno != EEXIST) {
+                return false;
+            }
+
+            if (!create(current)) {
+                return false;
+            }
+
+            rotate_deadline = monotonic_seconds() + options.rotate_interval.count();
+            stopping = false;
+            worker = std::thread(&journal_t::worker_main, this);
+            return true;
+        }
+
+        // Segments grow with the preamble, so every new one still has room for records after it
+        void add_preamble(const std::string_view data)
+        {
+            preamble.append(data);
+            if (preamble.size() > segment_size.load(std::memory_order_relaxed) / 2) {
+                segment_size = preamble.size() + options.segment_size;
+            }
+        }
+
+        void close()
+        {
+            {
+                std::lock_guard log_lock(debug::log_mutex);
+                std::lock_guard lock(mutex);
+                retired.push_back(std::move(current));
+                current = {};
+                stopping = true;
+            }
+
+            wakeup.notify_one();
+            worker.join();
+            for (auto & segment : retired) {
+                finalize(segment);
+            }
+            retired.clear();
+            if (spare)
+            {
+                finalize(*spare);
+                spare.reset();
+            }
+        }
+
+        ~journal_t()
+        {
+            if (worker.joinable()) {
+                close();
+            }
+        }
+
+        void write(std::string_view data)
+        {
+            if (options.rotate_interval.count() > 0 && current.used != 0 && monotonic_seconds() >= rotate_deadline
+                && !rotate())
+            {
+                return;
+            }
+
+            // a record stays in one segment, it is only split when no segment could hold it
+            const std::size_t room = segment_size.load(std::memory_order_relaxed) - preamble.size();
+            if (current.base != nullptr && current.used != 0 && data.size() > current.size - current.used
+                && data.size() <= room && !rotate())
+            {
+                return;
+            }
+
+            for (bool split = false; !data.empty(); split = true)
+            {
+                if (current.base == nullptr || (current.used == current.size && !rotate(!split))) {
+                    return; // out of disk space or descriptors, reported by rotate()
+                }
+
+                const std::size_t length = std::min(data.size(), current.size - current.used);
+                std::memcpy(current.base + current.used, data.data(), length);
+                current.used += length;
+                data.remove_prefix(length);
+            }
+        }
+    };
+
+    journal_t & journal()
+    {
+        static journal_t instance;
+        return instance;
+    }
+}
+
+bool debug::log_file::open(const options_t & options)
+{
+    if (enabled) {
+        return true;
+    }
+
+    if (!journal().open(options)) {
+        return false;
+    }
+
+    std::lock_guard lock(log_mutex);
+    enabled = true;
+    return true;
+}
+
+void debug::log_file::close()
+{
+    {
+        std::lock_guard lock(log_mutex);
+        if (!enabled) {
+            return;
+        }
+        enabled = false;
+    }
+
+    journal().close();
+}
+
+void debug::log_file::write(const std::string_view data)
+{
+    journal().write(data);
+}
+
+void debug::log_file::add_preamble(const std::string_view data)
+{
+    std::lock_guard lock(log_mutex);
+    journal().add_preamble(data);
+}
@@ -0,0 +1,131 @@
+/* log_sink.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <vector>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "log_sink.h"
+#include "log_file.h"
+#include "log.hpp"
+
+namespace {
+    // Writes all of iov, resuming after short writes. Errors are dropped, there is nowhere left to report them.
+    void write_all(const int fd, iovec * iov, int count)
+    {
+        while (count > 0)
+        {
+            ssize_t written = writev(fd, iov, std::min(count, IOV_MAX));
+            if (written < 0)
+            {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+
+            while (count > 0 && static_cast<std::size_t>(written) >= iov->iov_len)
+            {
+                written -= static_cast<ssize_t>(iov->iov_len);
+                iov++;
+                count--;
+            }
+
+            if (count > 0)
+            {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+                iov->iov_len -= written;
+            }
+        }
+    }
+}
+
+void debug::sink::write(const std::string_view record)
+{
+    std::lock_guard lock(log_mutex);
+    if (log_file::enabled)
+    {
+        log_file::write(record);
+        return;
+    }
+
+    if (output_fd >= 0)
+    {
+        iovec iov { .iov_base = const_cast<char *>(record.data()), .iov_len = record.size() };
+        write_all(output_fd, &iov, 1);
+        return;
+    }
+
+    output->write(record.data(), static_cast<std::streamsize>(record.size()));
+}
+
+void debug::sink::write(const std::span<const std::string> records)
+{
+    std::lock_guard lock(log_mutex);
+    if (log_file::enabled)
+    {
+        for (const auto & record : records) {
+            log_file::write(record);
+        }
+        return;
+    }
+
+    if (output_fd >= 0)
+    {
+        thread_local std::vector<iovec> iov;
+        iov.clear();
+        for (const auto & record : records)
+        {
+            if (!record.empty()) {
+                iov.push_back({ .iov_base = const_cast<char *>(record.data()), .iov_len = record.size() });
+            }
+        }
+        write_all(output_fd, iov.data(), static_cast<int>(iov.size()));
+        return;
+    }
+
+    for (const auto & record : records) {
+        output->write(record.data(), static_cast<std::streamsize>(record.size()));
+    }
+    output->flush();
+}
+
+void debug::sink::flush()
+{
+    std::lock_guard lock(log_mutex);
+    if (!log_file::enabled && output_fd < 0) {
+        output->flush();
+    }
+}
+
+void debug::sink::commit(std::string & record, const unsigned int level)
+{
+    if (async::active()) {
+        async::submit(std::move(record));
+    } else {
+        write(record);
+    }
+
+    if (level >= 3) { // make sure errors hit the output before the caller goes on
+        async::flush();
+    }
+}
@@ -0,0 +1,744 @@
+/* symbolizer.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <cxxabi.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "symbolizer.h"
+
+namespace {
+    // Bounds checked cursor over a section, a read past the end leaves it failed and returns 0
+    class reader_t
+    {
+        const std::uint8_t * pos = nullptr;
+        const std::uint8_t * end = nullptr;
+
+    public:
+        reader_t() = default;
+        reader_t(const std::uint8_t * begin, const std::size_t size) : pos(begin), end(begin + size) { }
+
+        [[nodiscard]] bool good() const { return pos != nullptr && pos <= end; }
+        [[nodiscard]] bool at_end() const { return !good() || pos == end; }
+        [[nodiscard]] const std::uint8_t * current() const { return pos; }
+
+        bool skip(const std::uint64_t count)
+        {
+            if (!good() || static_cast<std::uint64_t>(end - pos) < count)
+            {
+                pos = nullptr;
+                return false;
+            }
+            pos += count;
+            return true;
+        }
+
+        template <typename T>
+        T get()
+        {
+            T value {};
+            const auto * from = pos;
+            if (skip(sizeof(T))) {
+                std::memcpy(&value, from, sizeof(T));
+            }
+            return value;
+        }
+
+        std::uint64_t get_sized(const std::size_t size)
+        {
+            switch (size)
+            {
+                case 1: return get<std::uint8_t>();
+                case 2: return get<std::uint16_t>();
+                case 4: return get<std::uint32_t>();
+                case 8: return get<std::uint64_t>();
+                default: skip(size); return 0;
+            }
+        }
+
+        std::uint64_t uleb()
+        {
+            std::uint64_t result = 0;
+            for (unsigned shift = 0; good() && pos < end; shift += 7)
+            {
+                const std::uint8_t byte = *pos++;
+                if (shift < 64) {
+                    result |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+                }
+                if ((byte & 0x80) == 0) {
+                    return result;
+                }
+            }
+            pos = nullptr;
+            return 0;
+        }
+
+        std::int64_t sleb()
+        {
+            std::int64_t result = 0;
+            unsigned shift = 0;
+            std::uint8_t byte = 0x80;
+            while (good() && pos < end && (byte & 0x80) != 0)
+            {
+                byte = *pos++;
+                if (shift < 64) {
+                    result |= static_cast<std::int64_t>(byte & 0x7F) << shift;
+                }
+                shift += 7;
+            }
+            if ((byte & 0x80) != 0)
+            {
+                pos = nullptr;
+                return 0;
+            }
+            if (shift < 64 && (byte & 0x40) != 0) {
+                result |= -(static_cast<std::int64_t>(1) << shift);
+            }
+            return result;
+        }
+
+        std::string_view cstring()
+        {
+            if (!good()) {
+                return { };
+            }
+            const auto * terminator = static_cast<const std::uint8_t *>(std::memchr(pos, 0, end - pos));
+            if (terminator == nullptr)
+            {
+                pos = nullptr;
+                return { };
+            }
+            const std::string_view result(reinterpret_cast<const char *>(pos), terminator - pos);
+            pos = terminator + 1;
+            return result;
+        }
+    };
+
+    std::string_view string_at(const std::string_view table, const std::uint64_t offset)
+    {
+        if (offset >= table.size()) {
+            return { };
+        }
+        const std::string_view rest = table.substr(offset);
+        return rest.substr(0, rest.find('\0'));
+    }
+
+    std::string demangle(const char * name)
+    {
+        int status = 0;
+        char * demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        std::string result = status == 0 && demangled != nullptr ? demangled : name;
+        std::free(demangled);
+        return result;
+    }
+
+    struct symbol_t
+    {
+        std::uintptr_t address;
+        std::uintptr_t size;
+        const char * name;      // points into the mapped file
+    };
+
+    constexpr std::uint32_t unknown_file = UINT32_MAX;
+
+    struct row_t
+    {
+        std::uintptr_t address;
+        std::uint32_t file;     // index into elf_image_t::files, unknown_file if there is none
+        std::uint32_t line;
+        bool end_sequence;
+    };
+
+    // DWARF constants used by the line program
+    enum : std::uint8_t
+    {
+        DW_LNS_copy = 1, DW_LNS_advance_pc, DW_LNS_advance_line, DW_LNS_set_file, DW_LNS_set_column,
+        DW_LNS_negate_stmt, DW_LNS_set_basic_block, DW_LNS_const_add_pc, DW_LNS_fixed_advance_pc,
+    };
+    enum : std::uint8_t { DW_LNE_end_sequence = 1, DW_LNE_set_address, DW_LNE_define_file };
+    enum : std::uint8_t { DW_LNCT_path = 1, DW_LNCT_directory_index };
+    enum : std::uint8_t
+    {
+        DW_FORM_block2 = 0x03, DW_FORM_block4 = 0x04, DW_FORM_data2 = 0x05, DW_FORM_data4 = 0x06,
+        DW_FORM_data8 = 0x07, DW_FORM_string = 0x08, DW_FORM_block = 0x09, DW_FORM_block1 = 0x0a,
+        DW_FORM_data1 = 0x0b, DW_FORM_sdata = 0x0d, DW_FORM_strp = 0x0e, DW_FORM_udata = 0x0f,
+        DW_FORM_data16 = 0x1e, DW_FORM_line_strp = 0x1f,
+    };
+
+    // One mapped ELF file with its sorted symbol and line tables
+    class elf_image_t
+    {
+        void * mapping = MAP_FAILED;
+        std::size_t mapping_size = 0;
+        std::vector<symbol_t> symbols;
+        std::vector<row_t> rows;
+        std::vector<std::string> files;
+
+        struct section_t
+        {
+            const std::uint8_t * data = nullptr;
+            std::size_t size = 0;
+            [[nodiscard]] std::string_view view() const { return { reinterpret_cast<const char *>(data), size }; }
+        };
+
+        [[nodiscard]] const std::uint8_t * bytes() const { return static_cast<const std::uint8_t *>(mapping); }
+
+        section_t section(const ElfW(Shdr) & header) const
+        {
+            if (header.sh_type == SHT_NOBITS || (header.sh_flags & SHF_COMPRESSED) != 0
+                || header.sh_offset > mapping_size || header.sh_size > mapping_size - header.sh_offset)
+            {
+                return { };
+            }
+            return { bytes() + header.sh_offset, header.sh_size };
+        }
+
+        void load_symbols(const section_t & table, const section_t & strings)
+        {
+            const std::string_view names = strings.view();
+            const auto * entries = reinterpret_cast<const ElfW(Sym) *>(table.data);
+            const std::size_t count = table.size / sizeof(ElfW(Sym));
+            for (std::size_t i = 0; i < count; i++)
+            {
+                ElfW(Sym) symbol;
+                std::memcpy(&symbol, entries + i, sizeof(symbol));
+                if (ELF64_ST_TYPE(symbol.st_info) != STT_FUNC || symbol.st_value == 0 || symbol.st_name >= names.size()) {
+                    continue;
+                }
+                symbols.push_back({ symbol.st_value, symbol.st_size, names.data() + symbol.st_name });
+            }
+
+            std::ranges::sort(symbols, {}, &symbol_t::address);
+        }
+
+        // reads one DWARF 5 entry of a directory or file name table
+        static bool read_entry(reader_t & reader, const std::vector<std::pair<std::uint64_t, std::uint64_t>> & formats,
+            const bool is_64, const section_t & line_str, const section_t & str,
+            std::string_view & path, std::uint64_t & directory)
+        {
+            for (const auto & [content, form] : formats)
+            {
+                std::string_view text;
+                std::uint64_t value = 0;
+                switch (form)
+                {
+                    case DW_FORM_string: text = reader.cstring(); break;
+                    case DW_FORM_line_strp: text = string_at(line_str.view(), reader.get_sized(is_64 ? 8 : 4)); break;
+                    case DW_FORM_strp: text = string_at(str.view(), reader.get_sized(is_64 ? 8 : 4)); break;
+                    case DW_FORM_udata: value = reader.uleb(); break;
+                    case DW_FORM_sdata: value = static_cast<std::uint64_t>(reader.sleb()); break;
+                    case DW_FORM_data1: value = reader.get<std::uint8_t>(); break;
+                    case DW_FORM_data2: value = reader.get<std::uint16_t>(); break;
+                    case DW_FORM_data4: value = reader.get<std::uint32_t>(); break;
+                    case DW_FORM_data8: value = reader.get<std::uint64_t>(); break;
+                    case DW_FORM_data16: reader.skip(16); break;
+                    case DW_FORM_block: reader.skip(reader.uleb()); break;
+                    case DW_FORM_block1: reader.skip(reader.get<std::uint8_t>()); break;
+                    case DW_FORM_block2: reader.skip(reader.get<std::uint16_t>()); break;
+                    case DW_FORM_block4: reader.skip(reader.get<std::uint32_t>()); break;
+                    default: return false; // a form that cannot be skipped without .debug_str_offsets
+                }
+
+                if (content == DW_LNCT_path) {
+                    path = text;
+                } else if (content == DW_LNCT_directory_index) {
+                    directory = value;
+                }
+            }
+            return reader.good();
+        }
+
+        static std::string join(const std::string_view directory, const std::string_view name)
+        {
+            if (directory.empty() || name.starts_with('/')) {
+                return std::string(name);
+            }
+            std::string path(directory);
+            path += '/';
+            path += name;
+            return path;
+        }
+
+        // one unit of .debug_line, returns false if it cannot be parsed (the rest of the section is skipped then)
+        bool load_line_unit(reader_t & section_reader, const section_t & line_str, const section_t & str)
+        {
+            std::uint64_t unit_length = section_reader.get<std::uint32_t>();
+            const bool is_64 = unit_length == 0xFFFFFFFF;
+            if (is_64) {
+                unit_length = section_reader.get<std::uint64_t>();
+            }
+
+            const std::uint8_t * unit_begin = section_reader.current();
+            if (!section_reader.skip(unit_length)) {
+                return false;
+            }
+            reader_t reader(unit_begin, unit_length);
+
+            const auto version = reader.get<std::uint16_t>();
+            if (version < 2 || version > 5) {
+                return true; // unknown version, skip just this unit
+            }
+
+            std::uint8_t address_size = sizeof(void *);
+            if (version >= 5)
+            {
+                address_size = reader.get<std::uint8_t>();
+                reader.get<std::uint8_t>(); // segment selector size
+            }
+
+            const std::uint64_t header_length = is_64 ? reader.get<std::uint64_t>() : reader.get<std::uint32_t>();
+            const std::uint8_t * program_begin = reader.current() + header_length;
+            const auto minimum_instruction_length = reader.get<std::uint8_t>();
+            if (version >= 4) {
+                reader.get<std::uint8_t>(); // maximum operations per instruction, VLIW only
+            }
+            reader.get<std::uint8_t>(); // default_is_stmt
+            const auto line_base = reader.get<std::int8_t>();
+            const auto line_range = reader.get<std::uint8_t>();
+            const auto opcode_base = reader.get<std::uint8_t>();
+            if (line_range == 0 || opcode_base == 0) {
+                return true;
+            }
+
+            std::vector<std::uint8_t> opcode_lengths(opcode_base);
+            for (std::uint8_t i = 1; i < opcode_base; i++) {
+                opcode_lengths[i] = reader.get<std::uint8_t>();
+            }
+
+            // file register value -> index into files
+            std::vector<std::uint32_t> unit_files;
+            std::vector<std::string_view> directories;
+            if (version >= 5)
+            {
+                auto read_formats = [&reader] {
+                    std::vector<std::pair<std::uint64_t, std::uint64_t>> formats(reader.get<std::uint8_t>());
+                    for (auto & [content, form] : formats)
+                    {
+                        content = reader.uleb();
+                        form = reader.uleb();
+                    }
+                    return formats;
+                };
+
+                const auto directory_formats = read_formats();
+                const std::uint64_t directory_count = reader.uleb();
+                for (std::uint64_t i = 0; i < directory_count && reader.good(); i++)
+                {
+                    std::string_view path;
+                    std::uint64_t unused = 0;
+                    if (!read_entry(reader, directory_formats, is_64, line_str, str, path, unused)) {
+                        return true;
+                    }
+                    directories.push_back(path);
+                }
+
+                const auto file_formats = read_formats();
+                const std::uint64_t file_count = reader.uleb();
+                for (std::uint64_t i = 0; i < file_count && reader.good(); i++)
+                {
+                    std::string_view path;
+                    std::uint64_t directory = 0;
+                    if (!read_entry(reader, file_formats, is_64, line_str, str, path, directory)) {
+                        return true;
+                    }
+                    unit_files.push_back(static_cast<std::uint32_t>(files.size()));
+                    std::string directory_path(directory < directories.size() ? directories[directory] : "");
+                    if (directory != 0 && !directories.empty()) { // relative to the compilation directory
+                        directory_path = join(directories[0], directory_path);
+                    }
+                    files.push_back(join(directory_path, path));
+                }
+            }
+            else
+            {
+                directories.emplace_back(); // index 0 is the compilation directory, not recorded here
+                for (auto directory = reader.cstring(); reader.good() && !directory.empty(); directory = reader.cstring()) {
+                    directories.push_back(directory);
+                }
+
+                unit_files.push_back(unknown_file); // file numbers start at 1
+                for (auto name = reader.cstring(); reader.good() && !name.empty(); name = reader.cstring())
+                {
+                    const std::uint64_t directory = reader.uleb();
+                    reader.uleb(); // modification time
+                    reader.uleb(); // length
+                    unit_files.push_back(static_cast<std::uint32_t>(files.size()));
+                    files.push_back(join(directory < directories.size() ? directories[directory] : "", name));
+                }
+            }
+
+            if (!reader.good() || program_begin > unit_begin + unit_length) {
+                return true;
+            }
+
+            // the line number program
+            reader_t program(program_begin, unit_begin + unit_length - program_begin);
+            std::uintptr_t address = 0;
+            std::uint64_t file = 1;
+            std::int64_t line = 1;
+            std::size_t sequence_begin = rows.size();
+
+            auto emit = [&](const bool end_sequence)
+            {
+                const std::uint32_t file_index = file < unit_files.size() ? unit_files[file] : unknown_file;
+                rows.push_back({ address, file_index, static_cast<std::uint32_t>(std::max<std::int64_t>(line, 0)),
+                    end_sequence });
+            };
+
+            while (!program.at_end())
+            {
+                const auto opcode = program.get<std::uint8_t>();
+                if (opcode >= opcode_base)
+                {
+                    const std::uint8_t adjusted = opcode - opcode_base;
+                    address += (adjusted / line_range) * minimum_instruction_length;
+                    line += line_base + adjusted % line_range;
+                    emit(false);
+                    continue;
+                }
+
+                switch (opcode)
+                {
+                    case 0: // extended opcode
+                    {
+                        const std::uint64_t length = program.uleb();
+                        const std::uint8_t * next = program.current() + length;
+                        if (length == 0 || !program.good()) {
+                            return true;
+                        }
+                        switch (program.get<std::uint8_t>())
+                        {
+                            case DW_LNE_end_sequence:
+                                // rows at the end address cover nothing, they would hide the end marker
+                                while (rows.size() > sequence_begin && rows.back().address == address) {
+                                    rows.pop_back();
+                                }
+                                emit(true);
+                                // code the linker discarded keeps address 0 (or a -1 tombstone), drop it
+                                if (rows[sequence_begin].address == 0 || rows[sequence_begin].address == ~std::uintptr_t { 0 }) {
+                                    rows.resize(sequence_begin);
+                                }
+                                sequence_begin = rows.size();
+                                address = 0;
+                                file = 1;
+                                line = 1;
+                                break;
+                            case DW_LNE_set_address:
+                                address = program.get_sized(std::min<std::uint64_t>(length - 1, address_size));
+                                break;
+                            case DW_LNE_define_file:
+                            {
+                                const auto name = program.cstring();
+                                const std::uint64_t directory = program.uleb();
+                                unit_files.push_back(static_cast<std::uint32_t>(files.size()));
+                                files.push_back(join(directory < directories.size() ? directories[directory] : "", name));
+                                break;
+                            }
+                            default: break;
+                        }
+                        const auto * now = program.current();
+                        if (!program.good() || now > next || !program.skip(next - now)) {
+                            return true;
+                        }
+                        break;
+                    }
+                    case DW_LNS_copy: emit(false); break;
+                    case DW_LNS_advance_pc: address += program.uleb() * minimum_instruction_length; break;
+                    case DW_LNS_advance_line: line += program.sleb(); break;
+                    case DW_LNS_set_file: file = program.uleb(); break;
+                    case DW_LNS_const_add_pc: address += ((255 - opcode_base) / line_range) * minimum_instruction_length; break;
+                    case DW_LNS_fixed_advance_pc: address += program.get<std::uint16_t>(); break;
+                    default: // DW_LNS_set_column, negate_stmt, prologue_end... only their operands matter
+                        for (std::uint8_t i = 0; i < opcode_lengths[opcode]; i++) {
+                            program.uleb();
+                        }
+                        break;
+                }
+            }
+
+            rows.resize(sequence_begin); // an unterminated sequence is not trusted
+            return true;
+        }
+
+    public:
+        explicit elf_image_t(const std::string & path)
+        {
+            const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+
+            struct stat st {};
+            if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(ElfW(Ehdr)))
+            {
+                mapping_size = st.st_size;
+                mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            close(fd);
+            if (mapping == MAP_FAILED) {
+                return;
+            }
+
+            ElfW(Ehdr) header;
+            std::memcpy(&header, bytes(), sizeof(header));
+            if (std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0 || header.e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32)
+                || header.e_shentsize != sizeof(ElfW(Shdr)) || header.e_shoff > mapping_size
+                || header.e_shnum > (mapping_size - header.e_shoff) / sizeof(ElfW(Shdr)) || header.e_shstrndx >= header.e_shnum)
+            {
+                return;
+            }
+
+            std::vector<ElfW(Shdr)> sections(header.e_shnum);
+            std::memcpy(sections.data(), bytes() + header.e_shoff, sections.size() * sizeof(ElfW(Shdr)));
+            const std::string_view section_names = section(sections[header.e_shstrndx]).view();
+
+            section_t symtab, dynsym, symtab_strings, dynsym_strings, debug_line, debug_line_str, debug_str;
+            for (const auto & entry : sections)
+            {
+                const std::string_view name = string_at(section_names, entry.sh_name);
+                if (entry.sh_type == SHT_SYMTAB && entry.sh_link < sections.size())
+                {
+                    symtab = section(entry);
+                    symtab_strings = section(sections[entry.sh_link]);
+                }
+                else if (entry.sh_type == SHT_DYNSYM && entry.sh_link < sections.size())
+                {
+                    dynsym = section(entry);
+                    dynsym_strings = section(sections[entry.sh_link]);
+                }
+                else if (name == ".debug_line") {
+                    debug_line = section(entry);
+                }
+                else if (name == ".debug_line_str") {
+                    debug_line_str = section(entry);
+                }
+                else if (name == ".debug_str") {
+                    debug_str = section(entry);
+                }
+            }
+
+            // stripped binaries still have the exported symbols
+            if (symtab.data != nullptr) {
+                load_symbols(symtab, symtab_strings);
+            } else if (dynsym.data != nullptr) {
+                load_symbols(dynsym, dynsym_strings);
+            }
+
+            if (debug_line.data != nullptr)
+            {
+                reader_t reader(debug_line.data, debug_line.size);
+                while (!reader.at_end() && load_line_unit(reader, debug_line_str, debug_str)) { }
+
+                // where one sequence ends and the next begins, the beginning has to win
+                std::ranges::stable_sort(rows, [](const row_t & a, const row_t & b) {
+                    return a.address != b.address ? a.address < b.address : a.end_sequence > b.end_sequence;
+                });
+            }
+        }
+
+        ~elf_image_t()
+        {
+            if (mapping != MAP_FAILED) {
+                munmap(mapping, mapping_size);
+            }
+        }
+
+        elf_image_t(const elf_image_t &) = delete;
+        elf_image_t & operator=(const elf_image_t &) = delete;
+
+        [[nodiscard]] const char * function_at(const std::uintptr_t address) const
+        {
+            auto it = std::ranges::upper_bound(symbols, address, {}, &symbol_t::address);
+            if (it == symbols.begin()) {
+                return nullptr;
+            }
+            --it;
+            // zero sized symbols (hand written assembly) get the benefit of the doubt
+            if (it->size != 0 && address >= it->address + it->size) {
+                return nullptr;
+            }
+            return it->name;
+        }
+
+        [[nodiscard]] const row_t * row_at(const std::uintptr_t address) const
+        {
+            auto it = std::ranges::upper_bound(rows, address, {}, &row_t::address);
+            if (it == rows.begin()) {
+                return nullptr;
+            }
+            --it;
+            return it->end_sequence ? nullptr : &*it;
+        }
+
+        // empty for unknown_file
+        [[nodiscard]] const std::string & file(const std::uint32_t index) const
+        {
+            static const std::string unknown;
+            return index < files.size() ? files[index] : unknown;
+        }
+    };
+
+    struct module_t
+    {
+        std::string path;
+        std::uintptr_t base = 0;
+        std::vector<std::pair<std::uintptr_t, std::uintptr_t>> segments; // [begin, end) of PT_LOAD
+    };
+
+    std::string executable_path()
+    {
+        char path[4096];
+        const ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        return length > 0 ? std::string(path, length) : "/proc/self/exe";
+    }
+
+    class symbolizer_t
+    {
+        std::mutex mutex;
+        std::vector<module_t> modules;
+        std::unordered_map<std::string, std::unique_ptr<elf_image_t>> images;
+        std::unordered_map<std::uintptr_t, debug::symbolizer::frame_t> cache;
+
+        void scan_modules()
+        {
+            modules.clear();
+            dl_iterate_phdr([](dl_phdr_info * info, size_t, void * data) -> int
+            {
+                auto & list = *static_cast<std::vector<module_t> *>(data);
+                module_t module;
+                module.base = info->dlpi_addr;
+                module.path = info->dlpi_name != nullptr && *info->dlpi_name != '\0' ? info->dlpi_name : "";
+                for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++)
+                {
+                    if (const auto & header = info->dlpi_phdr[i]; header.p_type == PT_LOAD)
+                    {
+                        const std::uintptr_t begin = info->dlpi_addr + header.p_vaddr;
+                        module.segments.emplace_back(begin, begin + header.p_memsz);
+                    }
+                }
+                list.push_back(std::move(module));
+                return 0;
+            }, &modules);
+
+            for (auto & module : modules)
+            {
+                if (module.path.empty()) {
+                    module.path = executable_path(); // the main program has no name in the link map
+                }
+            }
+        }
+
+        const module_t * find_module(const std::uintptr_t address) const
+        {
+            for (const auto & module : modules)
+            {
+                for (const auto & [begin, end] : module.segments)
+                {
+                    if (address >= begin && address < end) {
+                        return &module;
+                    }
+                }
+            }
+            return nullptr;
+        }
+
+        elf_image_t & image(const std::string & path)
+        {
+            auto & slot = images[path];
+            if (!slot) {
+                slot = std::make_unique<elf_image_t>(path);
+            }
+            return *slot;
+        }
+
+        debug::symbolizer::frame_t lookup(const std::uintptr_t address)
+        {
+            debug::symbolizer::frame_t frame;
+            const module_t * module = find_module(address);
+            if (module == nullptr)
+            {
+                scan_modules(); // loaded after the last scan
+                module = find_module(address);
+            }
+            if (module == nullptr) {
+                return frame;
+            }
+
+            frame.object = module->path;
+            frame.offset = address - module->base;
+            const auto & elf = image(module->path);
+            // a return address points after the call, which may already be the next function or line
+            const std::uintptr_t call_site = frame.offset - 1;
+            if (const char * name = elf.function_at(call_site); name != nullptr) {
+                frame.function = demangle(name);
+            }
+
+            if (const auto * row = elf.row_at(call_site); row != nullptr)
+            {
+                frame.file = elf.file(row->file);
+                frame.line = row->line;
+            }
+            return frame;
+        }
+
+    public:
+        std::vector<debug::symbolizer::frame_t> resolve(void * const * frames, const int count)
+        {
+            std::lock_guard lock(mutex);
+            if (modules.empty()) {
+                scan_modules();
+            }
+
+            std::vector<debug::symbolizer::frame_t> result;
+            result.reserve(count);
+            for (int i = 0; i < count; i++)
+            {
+                const auto address = reinterpret_cast<std::uintptr_t>(frames[i]);
+                auto it = cache.find(address);
+                if (it == cache.end()) {
+                    it = cache.emplace(address, lookup(address)).first;
+                }
+                result.push_back(it->second);
+            }
+            return result;
+        }
+    };
+
+    symbolizer_t & instance()
+    {
+        static symbolizer_t instance;
+        return instance;
+    }
+}
+
+std::vector<debug::symbolizer::frame_t> debug::symbolizer::resolve(void * const * frames, const int count)
+{
+    return instance().resolve(frames, count);
+}
@@ -0,0 +1,206 @@
+/* timestamp.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include "timestamp.h"
+
+std::atomic<debug::timestamp::precision_t> debug::timestamp::precision = precision_t::seconds;
+
+namespace {
+    constexpr std::size_t second_length = 19; // "YYYY-MM-DD HH:MM:SS"
+    constexpr std::int64_t invalid = std::numeric_limits<std::int64_t>::min();
+
+    // (minute << 20) | (offset + 2^19), so readers never see a minute paired with another minute's offset
+    constexpr int offset_bits = 20;
+    std::atomic<std::int64_t> offset_cache = invalid;
+
+    // Shared "YYYY-MM-DD HH:MM:SS" of the most recently rendered second, guarded by a sequence lock
+    std::atomic<std::uint64_t> cache_sequence = 0;
+    std::atomic<std::int64_t> cache_second = invalid;
+    std::atomic<std::uint64_t> cache_text[3] = {};
+
+    struct local_cache_t
+    {
+        std::int64_t second = invalid;
+        char text[sizeof(cache_text)] = {};
+    };
+    thread_local local_cache_t local_cache;
+
+    constexpr std::int64_t floor_div(const std::int64_t a, const std::int64_t b)
+    {
+        return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+    }
+
+    // UTC offset in effect at utc_second, refreshed through localtime_r() once per minute
+    std::int64_t local_utc_offset(const std::int64_t utc_second)
+    {
+        const std::int64_t minute = floor_div(utc_second, 60);
+        if (const auto cached = offset_cache.load(std::memory_order_relaxed);
+            cached != invalid && (cached >> offset_bits) == minute)
+        {
+            return (cached & ((1 << offset_bits) - 1)) - (1 << (offset_bits - 1));
+        }
+
+        const time_t when = utc_second;
+        tm local {};
+        localtime_r(&when, &local);
+        const std::int64_t offset = local.tm_gmtoff;
+        offset_cache.store(static_cast<std::int64_t>(static_cast<std::uint64_t>(minute) << offset_bits)
+            | (offset + (1 << (offset_bits - 1))), std::memory_order_relaxed);
+        return offset;
+    }
+
+    void put_digits(char * out, unsigned value, const int width)
+    {
+        for (int i = width - 1; i >= 0; i--)
+        {
+            out[i] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+    }
+
+    // Howard Hinnant's civil_from_days()
+    void render_second(const std::int64_t utc_second, const std::int64_t utc_offset, char * out)
+    {
+        const std::int64_t local = utc_second + utc_offset;
+        const std::int64_t days = floor_div(local, 86400);
+        const auto time_of_day = static_cast<unsigned>(local - days * 86400);
+
+        const std::int64_t z = days + 719468;
+        const std::int64_t era = floor_div(z, 146097);
+        const auto doe = static_cast<unsigned>(z - era * 146097);
+        const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        const unsigned mp = (5 * doy + 2) / 153;
+        const unsigned day = doy - (153 * mp + 2) / 5 + 1;
+        const unsigned month = mp < 10 ? mp + 3 : mp - 9;
+        const auto year = static_cast<unsigned>(yoe + era * 400 + (month <= 2));
+
+        put_digits(out, year, 4);
+        out[4] = '-';
+        put_digits(out + 5, month, 2);
+        out[7] = '-';
+        put_digits(out + 8, day, 2);
+        out[10] = ' ';
+        put_digits(out + 11, time_of_day / 3600, 2);
+        out[13] = ':';
+        put_digits(out + 14, time_of_day / 60 % 60, 2);
+        out[16] = ':';
+        put_digits(out + 17, time_of_day % 60, 2);
+    }
+
+    void copy_second(const std::int64_t second, char * out)
+    {
+        if (local_cache.second != second)
+        {
+            bool hit = false;
+            if (const auto begin = cache_sequence.load(std::memory_order_acquire); (begin & 1) == 0
+                && cache_second.load(std::memory_order_relaxed) == second)
+            {
+                std::uint64_t words[std::size(cache_text)];
+                for (std::size_t i = 0; i < std::size(cache_text); i++) {
+                    words[i] = cache_text[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (cache_sequence.load(std::memory_order_relaxed) == begin)
+                {
+                    std::memcpy(local_cache.text, words, sizeof(words));
+                    hit = true;
+                }
+            }
+
+            if (!hit)
+            {
+                render_second(second, local_utc_offset(second), local_cache.text);
+
+                // publish for the other threads unless someone else is already doing it
+                if (auto sequence = cache_sequence.load(std::memory_order_relaxed); (sequence & 1) == 0
+                    && cache_sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_relaxed))
+                {
+                    std::atomic_thread_fence(std::memory_order_release);
+                    std::uint64_t words[std::size(cache_text)];
+                    std::memcpy(words, local_cache.text, sizeof(words));
+                    cache_second.store(second, std::memory_order_relaxed);
+                    for (std::size_t i = 0; i < std::size(cache_text); i++) {
+                        cache_text[i].store(words[i], std::memory_order_relaxed);
+                    }
+                    cache_sequence.store(sequence + 2, std::memory_order_release);
+                }
+            }
+
+            local_cache.second = second;
+        }
+
+        std::memcpy(out, local_cache.text, second_length);
+    }
+
+    std::size_t put_fraction(char * out, const std::int64_t nanoseconds)
+    {
+        switch (debug::timestamp::precision.load(std::memory_order_relaxed))
+        {
+            case debug::timestamp::precision_t::milliseconds:
+                out[0] = '.';
+                put_digits(out + 1, static_cast<unsigned>(nanoseconds / 1000000), 3);
+                return 4;
+            case debug::timestamp::precision_t::microseconds:
+                out[0] = '.';
+                put_digits(out + 1, static_cast<unsigned>(nanoseconds / 1000), 6);
+                return 7;
+            default:
+                return 0;
+        }
+    }
+}
+
+std::int64_t debug::timestamp::clock_ns()
+{
+    timespec now {};
+    // the coarse clock is a plain vDSO read, good enough when nothing below a second is shown
+    clock_gettime(precision.load(std::memory_order_relaxed) == precision_t::seconds
+        ? CLOCK_REALTIME_COARSE : CLOCK_REALTIME, &now);
+    return static_cast<std::int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+std::string_view debug::timestamp::now(char * buffer)
+{
+    const std::int64_t now = clock_ns();
+    const std::int64_t second = floor_div(now, 1000000000);
+    copy_second(second, buffer);
+    return { buffer, second_length + put_fraction(buffer + second_length, now - second * 1000000000) };
+}
+
+std::string_view debug::timestamp::render(char * buffer, const std::int64_t epoch_ns)
+{
+    return render(buffer, epoch_ns, local_utc_offset(floor_div(epoch_ns, 1000000000)));
+}
+
+std::string_view debug::timestamp::render(char * buffer, const std::int64_t epoch_ns, const std::int64_t utc_offset)
+{
+    const std::int64_t second = floor_div(epoch_ns, 1000000000);
+    render_second(second, utc_offset, buffer);
+    return { buffer, second_length + put_fraction(buffer + second_length, epoch_ns - second * 1000000000) };
+}
+
+std::int64_t debug::timestamp::utc_offset(const std::int64_t utc_second)
+{
+    return local_utc_offset(utc_second);
+}
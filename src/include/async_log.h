@@ -0,0 +1,69 @@
+/* async_log.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace debug::async
+{
+    // What a producer does when the ring is full
+    enum class overflow_policy_t
+    {
+        block,          // wait for the writer thread to make room
+        drop,           // discard the new record and count it
+        drop_oldest,    // discard the oldest queued record and count it
+    };
+
+    constexpr std::size_t default_capacity = 4096;
+
+    extern std::atomic_bool enabled;
+
+    // Set on the writer thread, which writes its own records (the drop notice) straight to the sink
+    extern thread_local bool on_writer_thread;
+
+    /// Whether records go to the writer thread rather than straight to the sink
+    inline bool active()
+    {
+        return enabled && !on_writer_thread;
+    }
+
+    /// Start the background writer. Capacity is rounded up to a power of two.
+    /// Calling it while already running is a no-op.
+    void start(std::size_t capacity = default_capacity, overflow_policy_t policy = overflow_policy_t::block);
+
+    /// Drain everything queued so far, then join the writer thread.
+    /// Subsequent log calls fall back to synchronous output.
+    void stop();
+
+    /// Hand a formatted record over to the writer thread. Never touches the output stream.
+    void submit(std::string record);
+
+    /// Block until every record submitted before this call has been written out
+    void flush();
+
+    /// Number of records discarded by the drop / drop_oldest policies since start()
+    [[nodiscard]] std::uint64_t dropped();
+}
+
+#endif //ASYNC_LOG_H
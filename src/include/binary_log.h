@@ -0,0 +1,333 @@
+/* binary_log.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+// Deferred-formatting log mode (LOG_FORMAT=binary):
+// a call site is described once by a site record carrying its metadata and the
+// signature of its argument types, after that every call only copies raw argument
+// bytes. template_log_decoder renders the stream back into the text format.
+//
+// Stream layout, all integers little endian:
+//   header:  "TPLBLOG2" u8 verbose, str build_id, i32 utc_offset (seconds, of the writing machine)
+//   site:    u8 1, u32 id, u32 level, u32 line, str function, str file, str signature
+//   log:     u8 2, u32 id, u32 thread, u8 level, i64 epoch_ns, u32 payload_size, payload
+//   str:     u32 size, bytes
+// The thread number lets the decoder put lines logged in several parts back together per thread.
+
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include "log.hpp"
+
+namespace debug::binary
+{
+    constexpr char magic[8] = { 'T', 'P', 'L', 'B', 'L', 'O', 'G', '2' };
+
+    enum record_kind_t : std::uint8_t
+    {
+        site_record = 1,
+        log_record = 2,
+    };
+
+    namespace code
+    {
+        constexpr char boolean          = 'b';  // u8
+        constexpr char character        = 'c';  // u8
+        constexpr char signed_integer   = 'i';  // i64
+        constexpr char unsigned_integer = 'u';  // u64
+        constexpr char floating         = 'f';  // f64
+        constexpr char string           = 's';  // str
+        constexpr char pointer          = 'p';  // u64
+        constexpr char byte             = 'h';  // u8, element of a byte container
+        constexpr char manipulator      = 'm';  // u8, see manipulator_t
+        constexpr char text             = 't';  // str, rendered at the call site (no better encoding known)
+        constexpr char move_front       = 'F';
+        constexpr char cursor_off       = 'O';
+        constexpr char cursor_on        = 'N';
+        constexpr char nothing          = 'x';  // level tags and other arguments _log() prints nothing for
+        constexpr char container_begin  = '[';  // u32 count, elements
+        constexpr char container_end    = ']';
+        constexpr char map_begin        = '{';  // u32 count, key value pairs
+        constexpr char map_end          = '}';
+        constexpr char pair_begin       = '<';
+        constexpr char pair_end         = '>';
+    }
+
+    // Only these are replayed by the decoder, std::setw() and friends are rendered as (empty) text
+    enum manipulator_t : std::uint8_t
+    {
+        manip_dec, manip_hex, manip_oct, manip_fixed, manip_scientific, manip_other
+    };
+
+    template <typename T>
+    constexpr bool is_character_v = std::is_same_v<T, char> || std::is_same_v<T, signed char>
+        || std::is_same_v<T, unsigned char>;
+
+    // std::ostream prints these as an address, function pointers go through operator bool instead
+    template <typename T>
+    constexpr bool is_object_pointer_v = std::is_pointer_v<T> && !std::is_function_v<std::remove_pointer_t<T>>;
+
+    template <std::size_t N>
+    constexpr std::array<char, N + 1> append(const std::array<char, N> & sig, const char c)
+    {
+        std::array<char, N + 1> result {};
+        for (std::size_t i = 0; i < N; i++) {
+            result[i] = sig[i];
+        }
+        result[N] = c;
+        return result;
+    }
+
+    template <std::size_t N, std::size_t M>
+    constexpr std::array<char, N + M> append(const std::array<char, N> & a, const std::array<char, M> & b)
+    {
+        std::array<char, N + M> result {};
+        for (std::size_t i = 0; i < N; i++) {
+            result[i] = a[i];
+        }
+        for (std::size_t i = 0; i < M; i++) {
+            result[N + i] = b[i];
+        }
+        return result;
+    }
+
+    /// Type signature of one argument, following the same dispatch order as _log()
+    template <typename ParamType>
+    constexpr auto signature_of()
+    {
+        using T = std::remove_cvref_t<ParamType>;
+        constexpr std::array<char, 0> empty {};
+        if constexpr (is_text_v<T>) {
+            return append(empty, code::string);
+        }
+        else if constexpr (is_container_v<T> && (is_map_v<T> || is_unordered_map_v<T>)) {
+            return append(append(append(append(empty, code::map_begin),
+                signature_of<typename T::key_type>()), signature_of<typename T::mapped_type>()), code::map_end);
+        }
+        else if constexpr (is_container_v<T>) {
+            using element_type = std::remove_cvref_t<decltype(*std::begin(std::declval<const T &>()))>;
+            if constexpr (sizeof(element_type) == 1) {
+                return append(append(append(empty, code::container_begin), code::byte), code::container_end);
+            } else {
+                return append(append(append(empty, code::container_begin), signature_of<element_type>()),
+                    code::container_end);
+            }
+        }
+        else if constexpr (is_bool_v<T>) {
+            return append(empty, code::boolean);
+        }
+        else if constexpr (is_pair_v<T>) {
+            return append(append(append(append(empty, code::pair_begin),
+                signature_of<typename T::first_type>()), signature_of<typename T::second_type>()), code::pair_end);
+        }
+        else if constexpr (is_move_front_t_v<T>) {
+            return append(empty, code::move_front);
+        }
+        else if constexpr (is_cursor_off_t_v<T>) {
+            return append(empty, code::cursor_off);
+        }
+        else if constexpr (is_cursor_on_t_v<T>) {
+            return append(empty, code::cursor_on);
+        }
+        else if constexpr (level_of_tag<T>() != unspecified_level || is_strong_typedef<T>::value) {
+            return append(empty, code::nothing);
+        }
+        else if constexpr (is_character_v<T>) {
+            return append(empty, code::character);
+        }
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+            return append(empty, code::signed_integer);
+        }
+        else if constexpr (std::is_integral_v<T>) {
+            return append(empty, code::unsigned_integer);
+        }
+        else if constexpr (std::is_floating_point_v<T>) {
+            return append(empty, code::floating);
+        }
+        else if constexpr (std::is_function_v<T>) {
+            return append(empty, code::manipulator);
+        }
+        else if constexpr (is_object_pointer_v<T>) {
+            return append(empty, code::pointer);
+        }
+        else {
+            return append(empty, code::text);
+        }
+    }
+
+    template <typename First, typename... Rest>
+    constexpr auto signature_of_all()
+    {
+        if constexpr (sizeof...(Rest) == 0) {
+            return signature_of<First>();
+        } else {
+            return append(signature_of<First>(), signature_of_all<Rest...>());
+        }
+    }
+
+    template <typename T>
+    void put(std::string & out, const T value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    inline void put_string(std::string & out, const std::string_view str)
+    {
+        put(out, static_cast<std::uint32_t>(str.size()));
+        out.append(str);
+    }
+
+    template <typename ParamType>
+    void encode(std::string & out, const ParamType & param)
+    {
+        using T = std::remove_cvref_t<ParamType>;
+        if constexpr (is_text_v<T>) {
+            put_string(out, param);
+        }
+        else if constexpr (is_container_v<T>) {
+            const auto count = static_cast<std::uint32_t>(std::distance(std::begin(param), std::end(param)));
+            put(out, count);
+            if constexpr (is_map_v<T> || is_unordered_map_v<T>)
+            {
+                for (const auto & [key, value] : param)
+                {
+                    encode(out, key);
+                    encode(out, value);
+                }
+            }
+            else
+            {
+                using element_type = std::remove_cvref_t<decltype(*std::begin(param))>;
+                if constexpr (sizeof(element_type) == 1 && std::is_trivially_copyable_v<element_type>
+                    && std::contiguous_iterator<decltype(std::begin(param))>)
+                {
+                    out.append(reinterpret_cast<const char *>(std::to_address(std::begin(param))), count);
+                }
+                else
+                {
+                    for (const auto & element : param)
+                    {
+                        if constexpr (sizeof(element_type) == 1) {
+                            std::uint8_t byte;
+                            std::memcpy(&byte, &element, 1);
+                            put(out, byte);
+                        } else {
+                            encode(out, element);
+                        }
+                    }
+                }
+            }
+        }
+        else if constexpr (is_bool_v<T>) {
+            put(out, static_cast<std::uint8_t>(param));
+        }
+        else if constexpr (is_pair_v<T>) {
+            encode(out, param.first);
+            encode(out, param.second);
+        }
+        else if constexpr (is_move_front_t_v<T> || is_cursor_off_t_v<T> || is_cursor_on_t_v<T>
+            || level_of_tag<T>() != unspecified_level || is_strong_typedef<T>::value)
+        {
+            // no payload
+        }
+        else if constexpr (is_character_v<T>) {
+            put(out, static_cast<std::uint8_t>(param));
+        }
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+            put(out, static_cast<std::int64_t>(param));
+        }
+        else if constexpr (std::is_integral_v<T>) {
+            put(out, static_cast<std::uint64_t>(param));
+        }
+        else if constexpr (std::is_floating_point_v<T>) {
+            put(out, static_cast<double>(param));
+        }
+        else if constexpr (std::is_function_v<T>) {
+            manipulator_t manipulator = manip_other;
+            if constexpr (std::is_same_v<T, std::ios_base &(std::ios_base &)>)
+            {
+                if (&param == &std::dec) manipulator = manip_dec;
+                else if (&param == &std::hex) manipulator = manip_hex;
+                else if (&param == &std::oct) manipulator = manip_oct;
+                else if (&param == &std::fixed) manipulator = manip_fixed;
+                else if (&param == &std::scientific) manipulator = manip_scientific;
+            }
+            put(out, static_cast<std::uint8_t>(manipulator));
+        }
+        else if constexpr (is_object_pointer_v<T>) {
+            put(out, reinterpret_cast<std::uint64_t>(static_cast<const volatile void *>(param)));
+        }
+        else {
+            std::ostringstream text;
+            text << param;
+            put_string(out, text.str());
+        }
+    }
+
+    /// Assign site an id and emit its site record, once
+    std::uint32_t register_site(const call_site_t & site, std::string_view signature);
+
+    std::string & record_buffer();
+
+    /// Small per process number of the calling thread, assigned on its first binary record
+    std::uint32_t thread_number();
+
+    template <typename... Args>
+    void log(const call_site_t & site, const Args &...args)
+    {
+        using FirstType = std::tuple_element_t<0, std::tuple<Args...>>;
+        unsigned int level = site.level;
+        if (level == unspecified_level) {
+            level = level_of_tag<FirstType>() == unspecified_level ? 1 : level_of_tag<FirstType>();
+        }
+
+        if (level < filter_level) {
+            return;
+        }
+
+        static constexpr auto signature = signature_of_all<Args...>();
+        std::uint32_t id = site.binary_id.load(std::memory_order_acquire);
+        if (id == 0) {
+            id = register_site(site, std::string_view(signature.data(), signature.size()));
+        }
+
+        auto & record = record_buffer();
+        record.clear();
+        put(record, static_cast<std::uint8_t>(log_record));
+        put(record, id);
+        put(record, thread_number());
+        put(record, static_cast<std::uint8_t>(level));
+        put(record, timestamp::clock_ns());
+        const std::size_t size_offset = record.size();
+        put(record, static_cast<std::uint32_t>(0));
+        (encode(record, args), ...);
+        const auto payload_size = static_cast<std::uint32_t>(record.size() - size_offset - sizeof(std::uint32_t));
+        std::memcpy(record.data() + size_offset, &payload_size, sizeof(payload_size));
+        sink::commit(record, level);
+    }
+}
+
+#endif //BINARY_LOG_H
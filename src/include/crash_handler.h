@@ -0,0 +1,42 @@
+/* crash_handler.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CRASH_HANDLER_H
+#define CRASH_HANDLER_H
+
+// Crash dumps for SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT. Everything the handler needs
+// (output fd, alternate signal stack, the unwinder) is set up at install time, so the handler
+// itself only calls async-signal-safe functions: a header with signal, fault address, BUILD_ID,
+// pid and tid, the raw frames through backtrace_symbols_fd() and a copy of /proc/self/maps,
+// from which the frames can be symbolized afterwards (addr2line -e <object> <offset>).
+// The default action is restored and the signal raised again, so core dumps still happen.
+//
+// Installed at startup if CPPCOWOVERLAY_CRASH_DUMP names a file (appended to) or "stderr".
+namespace debug::crash_handler
+{
+    /// Install the handlers, writing to path (or stderr for "stderr"). Returns false with errno set on failure.
+    bool install(const char * path);
+
+    /// Give the calling thread its own alternate signal stack, so a stack overflow there is reported too.
+    /// install() does this for the thread calling it.
+    bool protect_thread();
+}
+
+#endif //CRASH_HANDLER_H
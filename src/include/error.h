@@ -1,18 +1,29 @@
 #ifndef HALOKEYBOARD_ERROR_H
 #define HALOKEYBOARD_ERROR_H
 
+#include <expected>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 class require_back_trace_t {};
 extern require_back_trace_t require_back_trace;
 
 class cppCowOverlayBaseErrorType : public std::runtime_error
 {
+        // Only the raw frames are captured when thrown, symbolizing waits for the first what().
+        // Shared, so copies of the exception render the backtrace at most once between them.
+        struct lazy_backtrace_t;
+        std::shared_ptr<lazy_backtrace_t> lazy_backtrace;
+
     public:
         cppCowOverlayBaseErrorType() : std::runtime_error("") {}
         explicit cppCowOverlayBaseErrorType(const std::string &msg) : std::runtime_error(msg) {}
         explicit cppCowOverlayBaseErrorType(const require_back_trace_t&);
         explicit cppCowOverlayBaseErrorType(const require_back_trace_t&, const std::string &msg);
+        [[nodiscard]] const char * what() const noexcept override;
 };
 
 #define _error_h_lstr(x) #x
@@ -21,10 +32,63 @@ class cppCowOverlayBaseErrorType : public std::runtime_error
 #define cow_assert(condition, type) if (!(condition)) { throw type("Assert " #condition " failed at " __FILE__ ":" _error_h_str(__LINE__)); }
 #define cow_assert_wm(condition, type, message) if (!(condition)) { throw type(std::string(message) + (DEBUG ? ": " #condition " at " __FILE__ ":" _error_h_str(__LINE__) : "")); }
 
-// define a simple exception from the base class
+// Error value for paths where failure is routine (a lookup miss, a short read): carries the same
+// "type: message" as the exception it stands for and is returned through std::expected, so nothing
+// is thrown until raise() turns it into that exception at an API boundary.
+class cow_error_t
+{
+    public:
+        using raiser_t = void (*)(const std::string &);
+
+    private:
+        const char * type_name;
+        raiser_t raiser;
+        std::string error_message;
+
+    public:
+        cow_error_t(const char * type_name, const raiser_t raiser, std::string message)
+            : type_name(type_name), raiser(raiser), error_message(std::move(message)) {}
+        [[nodiscard]] const char * type() const noexcept { return type_name; }
+        [[nodiscard]] const std::string & message() const noexcept { return error_message; }
+        [[nodiscard]] std::string text() const { return std::string(type_name) + ": " + error_message; }
+
+        /// Throw the exception type this error was created for
+        [[noreturn]] void raise() const
+        {
+            raiser(error_message);
+            std::unreachable();
+        }
+};
+
+template < typename T >
+using cow_expected = std::expected<T, cow_error_t>;
+
+/// Value of result, or throw the exception its error stands for
+template < typename T >
+T cow_value_or_raise(cow_expected<T> && result)
+{
+    if (!result) {
+        result.error().raise();
+    }
+
+    if constexpr (!std::is_void_v<T>) {
+        return std::move(*result);
+    }
+}
+
+// cow_assert() and cow_assert_wm() that return type::error(...) instead of throwing, for functions returning cow_expected
+#define cow_check(condition, type) if (!(condition)) { return type::error("Assert " #condition " failed at " __FILE__ ":" _error_h_str(__LINE__)); }
+#define cow_check_wm(condition, type, message) if (!(condition)) { return type::error(std::string(message) + (DEBUG ? ": " #condition " at " __FILE__ ":" _error_h_str(__LINE__) : "")); }
+// return the error of a failed cow_expected to the caller
+#define cow_propagate(expression) if (auto _error_h_result = (expression); !_error_h_result) { return std::unexpected(std::move(_error_h_result.error())); }
+
+// define a simple exception from the base class, name::error(msg) makes the matching cow_error_t
 #define def_except_no_trace(name)                                                                                       \
     class name final : public cppCowOverlayBaseErrorType {                                                              \
         public: explicit name(const std::string & msg) : cppCowOverlayBaseErrorType(#name ": " + msg) {}                \
+        static std::unexpected<cow_error_t> error(std::string msg) {                                                    \
+            return std::unexpected(cow_error_t(#name, [](const std::string & m) { throw name(m); }, std::move(msg)));   \
+        }                                                                                                               \
     }
 
 #endif //HALOKEYBOARD_ERROR_H
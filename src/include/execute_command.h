@@ -1,8 +1,15 @@
 #ifndef EXECUTE_COMMAND_H
 #define EXECUTE_COMMAND_H
 
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "error.h"
 
 struct cmd_status
 {
@@ -11,7 +18,107 @@ struct cmd_status
     int exit_status{}; // exit status
 };
 
+// What the child reads from its stdin. Nothing is copied: text and buffers are written from where
+// they are (gathered with writev()), and an fd or file is handed to the child as its stdin.
+// Text/buffers, fd and file are alternatives: setting more than one of them fails the call
+// (exit_status 1, reason in fd_stderr) before anything is started. ensure_newline is ignored for an fd or file.
+struct cmd_input
+{
+    std::string_view text {};                       // written first,
+    std::span<const std::string_view> buffers {};   // then each of these, in order
+    int fd = -1;                                    // or, if not -1, this fd is the child's stdin (stays owned by the caller)
+    std::string file {};                            // or, if not empty, this file is
+    bool ensure_newline = false;                    // append '\n' to text/buffers unless they already end with one
+};
+
+// The input is given a trailing newline if it has none
 cmd_status exec_command_(const std::string &, const std::vector<std::string> &, const std::string &);
+cmd_status exec_command_(const std::string & cmd, const std::vector<std::string> & args, const cmd_input & input);
+
+// Where exec_command_stream() sends one of the child's output streams
+struct cmd_output
+{
+    // Called with each chunk as it arrives, on the calling thread. Output is discarded if empty.
+    std::function<void(std::string_view)> on_data;
+    // If not -1, the child writes to this fd (file, socket, pipe...) itself and on_data is not used:
+    // the data never passes through this process. The fd stays owned by the caller.
+    int fd = -1;
+};
+
+struct cmd_stream_options
+{
+    cmd_output out;
+    cmd_output err;
+};
+
+// Like exec_command_(), but the output is streamed instead of collected, so it can be any size.
+// fd_stdout is left empty and fd_stderr only reports failures of exec_command_stream() itself.
+cmd_status exec_command_stream(const std::string & cmd, const std::vector<std::string> & args,
+    const cmd_input & input, const cmd_stream_options & options);
+
+def_except_no_trace(cmd_executor_error);
+
+// A command for cmd_executor. It owns everything it needs, since it may start long after submission.
+struct cmd_request
+{
+    std::string cmd;
+    std::vector<std::string> args {};
+    std::string input {};
+    bool ensure_newline = false;                // as in cmd_input
+    std::chrono::milliseconds timeout {};       // SIGTERM once it runs out (zero for none), SIGKILL a grace period later.
+                                                // Output pipes still held open past it (by a background child) are cut.
+};
+
+// Runs commands in parallel, at most max_running at a time. A single reactor thread starts them,
+// pumps all their pipes through epoll and reaps them through pidfds, so nothing blocks per child.
+class cmd_executor
+{
+    struct state_t;
+    std::unique_ptr<state_t> state;
+
+public:
+    /// max_running of zero means one per hardware thread
+    explicit cmd_executor(std::size_t max_running = 0, std::chrono::milliseconds kill_grace = std::chrono::seconds(1));
+    /// Waits for everything submitted to finish
+    ~cmd_executor();
+    cmd_executor(const cmd_executor &) = delete;
+    cmd_executor & operator=(const cmd_executor &) = delete;
+
+    std::future<cmd_status> submit(cmd_request request);
+    std::vector<std::future<cmd_status>> submit(std::vector<cmd_request> batch);
+};
+
+def_except_no_trace(cmd_coprocess_error);
+
+// A long-lived helper process that answers requests written to its stdin on its stdout, so repeated
+// calls cost a pipe round trip instead of a process launch. The child's stderr is our stderr.
+// It is started on the first request, started again if it died (the failed request is retried
+// once), and stopped after idle_timeout without requests (zero to keep it). A helper that takes
+// longer than response_timeout to take a request and answer it is stopped and the request fails
+// without a retry (zero to wait forever). Thread-safe.
+class cmd_coprocess
+{
+    struct state_t;
+    std::unique_ptr<state_t> state;
+
+public:
+    enum class framing
+    {
+        line,   // requests and responses are lines, a missing '\n' is added to requests
+        length, // requests and responses are a std::uint32_t byte count (host order) and the bytes
+    };
+
+    cmd_coprocess(std::string cmd, std::vector<std::string> args, framing frames = framing::line,
+        std::chrono::milliseconds idle_timeout = std::chrono::seconds(30),
+        std::chrono::milliseconds response_timeout = std::chrono::seconds(10));
+    ~cmd_coprocess();
+    cmd_coprocess(const cmd_coprocess &) = delete;
+    cmd_coprocess & operator=(const cmd_coprocess &) = delete;
+
+    /// Send one request and wait for responses frames, returned concatenated (lines keep their '\n').
+    /// With framing::length, a message of 4 GiB or more is an error.
+    cow_expected<std::string> request(std::string_view message, std::size_t responses = 1);
+};
 
 template <typename... Strings>
 cmd_status exec_command(const std::string& cmd, const std::string &input, Strings&&... args)
@@ -0,0 +1,37 @@
+/* hex_dump.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HEX_DUMP_H
+#define HEX_DUMP_H
+
+#include <cstddef>
+#include <string>
+
+namespace debug
+{
+    /// Append a dump of size bytes to out, in the layout of hexdump -C:
+    ///   (20 bytes)
+    ///   00000000  de ad be ef 00 11 22 33  44 55 66 77 88 99 aa bb  |......"3DUfw....|
+    ///   00000010  41 42 43 44                                       |ABCD|
+    /// The last line has no trailing newline. 16 bytes at a time are converted with SSE2 where available.
+    void hex_dump(std::string & out, const void * data, std::size_t size);
+}
+
+#endif //HEX_DUMP_H
@@ -0,0 +1,278 @@
+/* json_log.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef JSON_LOG_H
+#define JSON_LOG_H
+
+// Structured log mode (LOG_FORMAT=json): one JSON object per line and per log call,
+//   {"time":"2025-01-31 12:34:56","level":"error","function":"main","file":"main.cpp","line":12,"args":[...]}
+// Arguments keep their type: numbers and booleans stay numbers and booleans, containers become
+// arrays and maps objects (walked like print_container()), everything else is a string.
+// Level tags and stream manipulators are left out, a trailing newline of the last argument is dropped
+// (a last argument that is nothing but a newline is left out as well).
+// Records are encoded straight into a reusable per thread buffer.
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include "log.hpp"
+
+namespace debug::json
+{
+    /// Append str as a quoted, escaped JSON string
+    void put_string(std::string & out, std::string_view str);
+
+    template <typename T>
+    void put_number(std::string & out, const T value)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            if (!std::isfinite(value))
+            {
+                out += std::isnan(value) ? "\"nan\"" : value > 0 ? "\"inf\"" : "\"-inf\"";
+                return;
+            }
+        }
+
+        char buffer[32];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, result.ptr);
+    }
+
+    // Collects operator<< output of types JSON has no encoding for, without a new allocation per call
+    class text_buffer_t final : public std::streambuf
+    {
+    public:
+        std::string text;
+
+    protected:
+        int_type overflow(const int_type c) override
+        {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                text.push_back(traits_type::to_char_type(c));
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char * s, const std::streamsize count) override
+        {
+            text.append(s, static_cast<std::size_t>(count));
+            return count;
+        }
+    };
+
+    /// Per thread scratch stream, cleared before returning
+    std::ostream & text_stream();
+    text_buffer_t & text_stream_buffer();
+
+    // arguments that produce no output in text mode either
+    template <typename T>
+    constexpr bool is_silent_v = level_of_tag<T>() != unspecified_level || std::is_function_v<T>
+        || is_move_front_t_v<T> || is_cursor_off_t_v<T> || is_cursor_on_t_v<T>;
+
+    template <typename ParamType>
+    void encode(std::string & out, const ParamType & param);
+
+    // JSON object keys must be strings
+    template <typename Key>
+    void encode_key(std::string & out, const Key & key)
+    {
+        using T = std::remove_cvref_t<Key>;
+        if constexpr (is_text_v<T>) {
+            put_string(out, key);
+        }
+        else if constexpr (std::is_arithmetic_v<T> && !is_bool_v<T> && !std::is_same_v<T, char>)
+        {
+            out += '"';
+            put_number(out, key);
+            out += '"';
+        }
+        else
+        {
+            std::string value;
+            encode(value, key);
+            put_string(out, value);
+        }
+    }
+
+    template <typename ParamType>
+    void encode(std::string & out, const ParamType & param)
+    {
+        using T = std::remove_cvref_t<ParamType>;
+        if constexpr (is_text_v<T>) {
+            put_string(out, param);
+        }
+        else if constexpr (is_container_v<T> && (is_map_v<T> || is_unordered_map_v<T>))
+        {
+            out += '{';
+            bool first = true;
+            for (const auto & [key, value] : param)
+            {
+                if (!first) {
+                    out += ',';
+                }
+                first = false;
+                encode_key(out, key);
+                out += ':';
+                encode(out, value);
+            }
+            out += '}';
+        }
+        else if constexpr (is_container_v<T>)
+        {
+            using element_type = std::remove_cvref_t<decltype(*std::begin(param))>;
+            out += '[';
+            bool first = true;
+            for (const auto & element : param)
+            {
+                if (!first) {
+                    out += ',';
+                }
+                first = false;
+                if constexpr (sizeof(element_type) == 1) { // bytes, as print_container() shows them
+                    std::uint8_t byte;
+                    std::memcpy(&byte, &element, 1);
+                    put_number(out, byte);
+                } else {
+                    encode(out, element);
+                }
+            }
+            out += ']';
+        }
+        else if constexpr (is_bool_v<T>) {
+            out += param ? "true" : "false";
+        }
+        else if constexpr (is_pair_v<T>)
+        {
+            out += '[';
+            encode(out, param.first);
+            out += ',';
+            encode(out, param.second);
+            out += ']';
+        }
+        else if constexpr (std::is_same_v<T, char>) {
+            put_string(out, std::string_view(&param, 1));
+        }
+        else if constexpr (std::is_arithmetic_v<T>) {
+            put_number(out, param);
+        }
+        else if constexpr (std::is_null_pointer_v<T>) {
+            out += "null";
+        }
+        else if constexpr (is_silent_v<T> || is_strong_typedef<T>::value) {
+            out += "null";
+        }
+        else
+        {
+            auto & buffer = text_stream_buffer();
+            text_stream() << param;
+            put_string(out, buffer.text);
+            buffer.text.clear();
+        }
+    }
+
+    // the newline only ends the line in text mode, it is not part of the message
+    template <typename ParamType>
+    void encode_last(std::string & out, const ParamType & param)
+    {
+        using T = std::remove_cvref_t<ParamType>;
+        if constexpr (is_text_v<T>)
+        {
+            std::string_view str = param;
+            if (!str.empty() && str.back() == '\n') {
+                str.remove_suffix(1);
+            }
+            put_string(out, str);
+        }
+        else {
+            encode(out, param);
+        }
+    }
+
+    // a last argument of just "\n" only ends the line in text mode, it is left out entirely
+    template <typename ParamType>
+    bool is_bare_newline(const ParamType & param)
+    {
+        using T = std::remove_cvref_t<ParamType>;
+        if constexpr (is_text_v<T>) {
+            return std::string_view(param) == "\n";
+        } else if constexpr (std::is_same_v<T, char>) {
+            return param == '\n';
+        } else {
+            return false;
+        }
+    }
+
+    std::string & record_buffer();
+
+    /// The part of a record before "args", rendered out of line
+    void begin_record(std::string & record, const call_site_t * site, unsigned int level);
+
+    template <typename... Args>
+    void log(const call_site_t * site, const Args &...args)
+    {
+        using FirstType = std::tuple_element_t<0, std::tuple<Args...>>;
+        unsigned int level = site != nullptr ? site->level : unspecified_level;
+        if (level == unspecified_level) {
+            level = level_of_tag<FirstType>() == unspecified_level ? 1 : level_of_tag<FirstType>();
+        }
+
+        if (level < filter_level) {
+            return;
+        }
+
+        auto & record = record_buffer();
+        record.clear();
+        begin_record(record, site, level);
+
+        bool first = true;
+        std::size_t index = 0;
+        const auto add = [&]<typename T>(const T & arg)
+        {
+            index++;
+            if constexpr (is_silent_v<std::remove_cvref_t<T>> || is_strong_typedef<std::remove_cvref_t<T>>::value) {
+                return;
+            }
+
+            if (index == sizeof...(Args) && is_bare_newline(arg)) {
+                return;
+            }
+
+            if (!first) {
+                record += ',';
+            }
+            first = false;
+            if (index == sizeof...(Args)) {
+                encode_last(record, arg);
+            } else {
+                encode(record, arg);
+            }
+        };
+        (add(args), ...);
+
+        record += "]}\n";
+        sink::commit(record, level);
+    }
+}
+
+#endif //JSON_LOG_H
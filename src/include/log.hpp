@@ -39,7 +39,13 @@
 #include <cstddef>
 #include <type_traits>
 #include <source_location>
+#include <sstream>
+#include <bit>
 #include "color.h"
+#include "async_log.h"
+#include "log_sink.h"
+#include "log_limit.h"
+#include "timestamp.h"
 
 #define construct_simple_type_compare(type)                             \
     template <typename T>                                               \
@@ -153,17 +159,41 @@ namespace debug {
     template <typename T>
     constexpr bool is_pair_v = is_pair<T>::value;
 
-    extern std::mutex log_mutex;
-    extern unsigned int log_level;
+    extern std::mutex log_mutex;    // serializes writes to the output
+    extern thread_local unsigned int log_level;
     extern std::atomic_uint filter_level;
-    extern bool endl_found_in_last_log;
+    extern thread_local bool endl_found_in_last_log;
     extern std::ostream * output;
+    extern int output_fd;           // file descriptor behind *output, written to directly; -1 to go through *output
+    extern thread_local std::ostream * render_output; // where _log() renders to, the thread's record buffer
+
+    enum class log_format_t
+    {
+        text,
+        binary,     // see binary_log.h
+        json,       // see json_log.h
+    };
+    extern std::atomic<log_format_t> log_format;
+
+    inline bool level_enabled(const unsigned int level) {
+        return level >= filter_level.load(std::memory_order_relaxed);
+    }
+
+    // Whether the thread's next text log call starts a new line (always so for binary and JSON records).
+    // A call continuing an unfinished line is part of that line and must not be filtered out on its own,
+    // it may carry the '\n' that ends it.
+    inline bool at_line_start() {
+        return endl_found_in_last_log;
+    }
 
     template <typename ParamType>
     void _log(const ParamType& param);
     template <typename ParamType, typename... Args>
     void _log(const ParamType& param, const Args&... args);
 
+    /// Render a byte range as a hex dump (see hex_dump.h), in a single write
+    void _log_bytes(const void * data, std::size_t size);
+
     /////////////////////////////////////////////////////////////////////////////////////////////
     template <typename Container>
 	requires (debug::is_container_v<Container> &&
@@ -171,6 +201,22 @@ namespace debug {
         !debug::is_unordered_map_v<Container>)
 	void print_container(const Container& container)
     {
+        using element_type = std::remove_cvref_t<decltype(*std::begin(container))>;
+        if constexpr (sizeof(element_type) == 1 /* 8bit data width */ && std::is_trivially_copyable_v<element_type>)
+        {
+            if constexpr (std::contiguous_iterator<decltype(std::begin(container))>) {
+                _log_bytes(std::to_address(std::begin(container)),
+                    static_cast<std::size_t>(std::distance(std::begin(container), std::end(container))));
+            } else {
+                std::vector<uint8_t> bytes;
+                for (const auto & element : container) {
+                    bytes.push_back(std::bit_cast<uint8_t>(element));
+                }
+                _log_bytes(bytes.data(), bytes.size());
+            }
+            return;
+        }
+
         constexpr uint64_t max_elements = 8;
         uint64_t num_elements = 0;
         _log("[");
@@ -183,15 +229,7 @@ namespace debug {
                 num_elements = 0;
             }
 
-            if (sizeof(*it) == 1 /* 8bit data width */)
-            {
-                const auto & tmp = *it;
-                _log("0x", std::hex, std::setw(2), std::setfill('0'),
-                    static_cast<unsigned>((*(uint8_t *)(&tmp)) & 0xFF)); // ugly workarounds
-            }
-            else {
-                _log(*it);
-            }
+            _log(*it);
 
             if (std::next(it) != std::end(container)) {
                 _log(", ");
@@ -223,29 +261,29 @@ namespace debug {
     {
         // NOLINTBEGIN(clang-diagnostic-repeated-branch-body)
         if constexpr (debug::is_string_v<ParamType>) { // if we don't do it here, it will be assumed as a container
-            *output << param;
+            *render_output << param;
         }
         else if constexpr (debug::is_container_v<ParamType>) {
             debug::print_container(param);
         }
         else if constexpr (debug::is_bool_v<ParamType>) {
-            *output << (param ? "True" : "False");
+            *render_output << (param ? "True" : "False");
         }
         else if constexpr (debug::is_pair_v<ParamType>) {
-            *output << "<";
+            *render_output << "<";
             _log(param.first);
-            *output << ": ";
+            *render_output << ": ";
             _log(param.second);
-            *output << ">";
+            *render_output << ">";
         }
         else if constexpr (debug::is_move_front_t_v<ParamType>) {
-            *output << "\033[F\033[K";
+            *render_output << "\033[F\033[K";
         }
         else if constexpr (debug::is_cursor_off_t_v<ParamType>) {
-            *output << "\033[?25l";
+            *render_output << "\033[?25l";
         }
         else if constexpr (debug::is_cursor_on_t_v<ParamType>) {
-            *output << "\033[?25h";
+            *render_output << "\033[?25h";
         }
         else if constexpr (debug::is_debug_log_t_v<ParamType>) {
             log_level = 0;
@@ -260,7 +298,7 @@ namespace debug {
             log_level = 3;
         }
         else {
-            *output << param;
+            *render_output << param;
         }
         // NOLINTEND(clang-diagnostic-repeated-branch-body)
     }
@@ -295,28 +333,6 @@ namespace debug {
         return false;
     }
 
-    template<typename T>
-    struct is_char_array : std::false_type {};
-
-    template<std::size_t N>
-    struct is_char_array<char[N]> : std::true_type {};
-
-    template<std::size_t N>
-    struct is_char_array<const char[N]> : std::true_type {};
-
-    template<std::size_t... Is, class Tuple>
-    constexpr auto tuple_drop_impl(Tuple&& t, std::index_sequence<Is...>) {
-        // shift indices by 1 to skip the head
-        return std::forward_as_tuple(std::get<Is + 1>(std::forward<Tuple>(t))...);
-    }
-
-    template<class Tuple>
-    constexpr auto tuple_drop1(Tuple&& t) {
-        constexpr std::size_t N = std::tuple_size_v<std::remove_reference_t<Tuple>>;
-        static_assert(N > 0, "cannot drop from empty tuple");
-        return tuple_drop_impl(std::forward<Tuple>(t), std::make_index_sequence<N - 1>{});
-    }
-
     template <typename T, typename Tag>
     struct strong_typedef
     {
@@ -330,77 +346,110 @@ namespace debug {
     };
     template <typename T, typename Tag> void _log(const strong_typedef<T, Tag>&) { }
 
-    struct prefix_string_tag {};
-    using prefix_string_t = strong_typedef<std::string, prefix_string_tag>;
+    template <typename T> struct is_strong_typedef : std::false_type { };
+    template <typename T, typename Tag> struct is_strong_typedef<strong_typedef<T, Tag>> : std::true_type { };
 
-    template <typename... Args> void log(const Args &...args)
+    // everything _log() prints as a plain string
+    template <typename T>
+    constexpr bool is_text_v = is_string_v<T> || std::is_same_v<T, char *>
+        || (std::is_array_v<T> && std::is_same_v<std::remove_cv_t<std::remove_extent_t<T>>, char>);
+
+    // Same result as matching R"([\w]+ (.*)\(.*\))" and keeping the capture, but usable at compile time
+    constexpr std::string_view strip_func_name(const std::string_view name)
     {
-        std::lock_guard lock(log_mutex);
-        static_assert(sizeof...(Args) > 0, "log(...) requires at least one argument");
-        auto ref_tuple = std::forward_as_tuple(args...);
-        using LastType = std::tuple_element_t<sizeof...(Args) - 1, std::tuple<Args...>>;
-        using FirstType = std::tuple_element_t<0, std::tuple<Args...>>;
-        const std::any last_arg = std::get<sizeof...(Args) - 1>(ref_tuple);
-        std::string user_prefix_addon;
+        std::size_t word = 0;
+        while (word < name.size() && ((name[word] >= 'a' && name[word] <= 'z') || (name[word] >= 'A' && name[word] <= 'Z')
+            || (name[word] >= '0' && name[word] <= '9') || name[word] == '_'))
+        {
+            word++;
+        }
+
+        if (word == 0 || word == name.size() || name[word] != ' ' || name.back() != ')') {
+            return name;
+        }
+
+        const std::size_t open = name.rfind('(');
+        if (open == std::string_view::npos || open <= word) {
+            return name;
+        }
+
+        return name.substr(word + 1, open - word - 1);
+    }
+
+    constexpr unsigned int unspecified_level = ~0u; // print_log(...): level comes from the tag argument
 
-        auto call_log = []<class... Ts>(Ts&&... xs) -> decltype(auto) {
-            return _log(std::forward<Ts>(xs)...);
+    // Everything known about a log statement at compile time, one static instance per call site
+    struct call_site_t
+    {
+        std::string_view function;
+        std::string_view file;
+        unsigned int line;
+        unsigned int level;
+        mutable std::atomic_uint32_t binary_id = 0; // assigned on first use in binary mode
+    };
+
+    namespace binary {
+        template <typename... Args> void log(const call_site_t & site, const Args &...args);
+    }
+
+    namespace json {
+        template <typename... Args> void log(const call_site_t * site, const Args &...args);
+    }
+
+    consteval call_site_t make_call_site(const std::source_location location, const unsigned int level)
+    {
+        return {
+            .function = strip_func_name(location.function_name()),
+            .file = location.file_name(),
+            .line = location.line(),
+            .level = level,
         };
+    }
 
-        if constexpr (std::is_same_v<FirstType, prefix_string_t>) // [PREFIX] [...]
-        {
-            const std::any first_arg = std::get<0>(ref_tuple);
-            user_prefix_addon = std::any_cast<prefix_string_t>(first_arg).value;
+    template <typename ParamType>
+    constexpr unsigned int level_of_tag()
+    {
+        if constexpr (debug::is_debug_log_t_v<ParamType>) {
+            return 0;
         }
+        else if constexpr (debug::is_info_log_t_v<ParamType>) {
+            return 1;
+        }
+        else if constexpr (debug::is_warning_log_t_v<ParamType>) {
+            return 2;
+        }
+        else if constexpr (debug::is_error_log_t_v<ParamType>) {
+            return 3;
+        }
+        else {
+            return unspecified_level;
+        }
+    }
+
+    // Renders one log call into *render_output
+    template <typename... Args> void _log_record(const call_site_t * site, const Args &...args)
+    {
+        static_assert(sizeof...(Args) > 0, "log(...) requires at least one argument");
+        using FirstType = std::tuple_element_t<0, std::tuple<Args...>>;
+        const auto & last_arg = std::get<sizeof...(Args) - 1>(std::forward_as_tuple(args...));
 
         if (endl_found_in_last_log)
         {
-            if (!user_prefix_addon.empty()) // Addon and second elements are all present
-            {
-                if constexpr (sizeof...(Args) >= 2)
-                {
-                    using SecondType = std::tuple_element_t<1, std::tuple<Args...>>;
-                    // instead of checking the first, we check the second
-                    if constexpr (debug::is_debug_log_t_v<SecondType>) {
-                        log_level = 0;
-                    }
-                    else if constexpr (debug::is_info_log_t_v<SecondType>) {
-                        log_level = 1;
-                    }
-                    else if constexpr (debug::is_warning_log_t_v<SecondType>) {
-                        log_level = 2;
-                    }
-                    else if constexpr (debug::is_error_log_t_v<SecondType>) {
-                        log_level = 3;
-                    }
-                }
+            if (site != nullptr && site->level != unspecified_level) {
+                log_level = site->level;
             }
-            else // else, we check the first for the presence of log level
-            {
-                if constexpr (debug::is_debug_log_t_v<FirstType>) {
-                    log_level = 0;
-                }
-                else if constexpr (debug::is_info_log_t_v<FirstType>) {
-                    log_level = 1;
-                }
-                else if constexpr (debug::is_warning_log_t_v<FirstType>) {
-                    log_level = 2;
-                }
-                else if constexpr (debug::is_error_log_t_v<FirstType>) {
-                    log_level = 3;
-                }
+            else if constexpr (level_of_tag<FirstType>() != unspecified_level) {
+                log_level = level_of_tag<FirstType>();
             }
 
-            const auto now = std::chrono::system_clock::now();
-            const auto local_time = std::chrono::current_zone()->to_local(now);
-            std::string prefix;
+            std::string_view prefix_color, prefix;
             switch (log_level)
             {
-                case 0: prefix =  color::color(1,1,1) + "[DEBUG]"; break;
-                case 1: prefix =  color::color(5,5,5) + "[INFO]"; break;
-                case 2: prefix =  color::color(0,5,5) + "[WARNING]"; break;
-                case 3: prefix =  color::color(5,0,0) + "[ERROR]"; break;
-                default: prefix = color::color(5,5,5) + "[INFO]"; break;
+                case 0: prefix_color = color::color(1,1,1); prefix = "[DEBUG]"; break;
+                case 1: prefix_color = color::color(5,5,5); prefix = "[INFO]"; break;
+                case 2: prefix_color = color::color(0,5,5); prefix = "[WARNING]"; break;
+                case 3: prefix_color = color::color(5,0,0); prefix = "[ERROR]"; break;
+                default: prefix_color = color::color(5,5,5); prefix = "[INFO]"; break;
             }
 
             // now, check if the log level is printable or masked
@@ -409,46 +458,148 @@ namespace debug {
                 return;
             }
 
-            _log(color::color(0, 2, 2), std::format("{:%Y-%m-%d %H:%M:%S}", local_time), " ",
-                user_prefix_addon, (user_prefix_addon.empty() ? "" : " "),
-                prefix, ": ", color::no_color());
+            char time_buffer[timestamp::max_length];
+            _log(color::color(0, 2, 2), timestamp::now(time_buffer), " ");
+            if (site != nullptr)
+            {
+                _log(color::color(2,3,4), "(", site->function);
+                if constexpr (VERBOSE) {
+                    _log(" ", site->file, ":", site->line);
+                }
+                _log(") ");
+            }
+            _log(prefix_color, prefix, ": ", color::no_color());
         }
 
-        if constexpr (!is_char_array<LastType>::value)
-        {
-            endl_found_in_last_log = _do_i_show_caller_next_time_(std::any_cast<LastType>(last_arg));
+        endl_found_in_last_log = _do_i_show_caller_next_time_(last_arg);
+        _log(args...);
+    }
+
+    template <typename FirstType, typename... Args>
+    void _log_record_dispatch(const FirstType & first, const Args &...args)
+    {
+        if constexpr (std::is_same_v<FirstType, const call_site_t *>) { // [SITE] [...]
+            _log_record(first, args...);
+        } else {
+            _log_record(static_cast<const call_site_t *>(nullptr), first, args...);
         }
-        else
-        {
-            endl_found_in_last_log = _do_i_show_caller_next_time_(std::any_cast<const char*>(last_arg));
+    }
+
+    template <typename FirstType, typename... Args>
+    void _log_binary_dispatch(const FirstType & first, const Args &...args)
+    {
+        if constexpr (std::is_same_v<FirstType, const call_site_t *>) {
+            binary::log(*first, args...);
+        } else {
+            static constinit const call_site_t anonymous_site = make_call_site({}, unspecified_level);
+            binary::log(anonymous_site, first, args...);
         }
+    }
 
-        if (user_prefix_addon.empty())
-        {
-            _log(args...);
+    template <typename FirstType, typename... Args>
+    void _log_json_dispatch(const FirstType & first, const Args &...args)
+    {
+        if constexpr (std::is_same_v<FirstType, const call_site_t *>) {
+            json::log(first, args...);
+        } else {
+            json::log(static_cast<const call_site_t *>(nullptr), first, args...);
         }
-        else if constexpr (sizeof...(Args) >= 2)
+    }
+
+    // A thread's log record under construction. Records are handed to the output (or the
+    // async writer) only once complete, so threads never interleave inside a line.
+    class thread_buffer_t
+    {
+    public:
+        static constexpr std::streamoff max_pending = 64 * 1024; // a line this long goes out unfinished
+        std::ostringstream stream;
+
+        void commit();
+        ~thread_buffer_t();
+    };
+
+    thread_buffer_t & thread_buffer();
+
+    template <typename... Args> void log(const Args &...args)
+    {
+        static_assert(sizeof...(Args) > 0, "log(...) requires at least one argument");
+        switch (log_format.load(std::memory_order_relaxed))
         {
-            std::apply(call_log, tuple_drop1(ref_tuple));
+            case log_format_t::binary: _log_binary_dispatch(args...); return;
+            case log_format_t::json: _log_json_dispatch(args...); return;
+            case log_format_t::text: break;
         }
-    }
 
-    std::string strip_func_name(const std::string &);
+        auto & buffer = thread_buffer();
+        render_output = &buffer.stream;
+        _log_record_dispatch(args...);
+        if (endl_found_in_last_log || buffer.stream.tellp() >= thread_buffer_t::max_pending) {
+            buffer.commit();
+        }
+    }
 
 }
 
 #define _lstr(x)            #x
 #define _str(x)             _lstr(x)
 
-#define print_log(...)      (void)::debug::log(debug::prefix_string_t(color::color(2,3,4) + "(" + debug::strip_func_name(std::source_location::current().function_name()) + (VERBOSE ? " " __FILE__ ":" _str(__LINE__) : "") + ")"), __VA_ARGS__)
+// Log levels below LOG_MIN_LEVEL are compiled out, see CMakeLists.txt
+#ifndef LOG_MIN_LEVEL
+# define LOG_MIN_LEVEL      0
+#endif
+
+// One static call_site_t per statement, so the log call itself only passes a pointer
+#define _log_call_site(level)                                                                           \
+    static constinit const ::debug::call_site_t _log_call_site_ =                                       \
+        ::debug::make_call_site(std::source_location::current(), (level))
+
+#define print_log(...)      do { _log_call_site(::debug::unspecified_level);                            \
+                                ::debug::log(&_log_call_site_, __VA_ARGS__); } while (false)
+// level is checked before any argument is evaluated, unless the call continues an unfinished line
+#define print_log_at(level, ...)                                                                        \
+    do {                                                                                                \
+        if ((level) >= LOG_MIN_LEVEL && (::debug::level_enabled(level) || !::debug::at_line_start())) { \
+            _log_call_site(level);                                                                      \
+            ::debug::log(&_log_call_site_, __VA_ARGS__);                                                \
+        }                                                                                               \
+    } while (false)
+// Rate limited variant: the limiter is consulted after the level check, a suppressed call returns
+// before its arguments are evaluated. Suppressed calls are reported in a "suppressed K messages" line at
+// most every 10 seconds; counts of call sites that went quiet are logged by a background thread, last at exit.
+// A call continuing an unfinished line is neither filtered nor limited, like in print_log_at().
+#define print_log_limited(kind, limit, level, ...)                                                      \
+    do {                                                                                                \
+        if ((level) >= LOG_MIN_LEVEL && (::debug::level_enabled(level) || !::debug::at_line_start())) { \
+            static constinit const ::debug::call_site_t _log_summary_site_ =                            \
+                ::debug::make_call_site(std::source_location::current(), (level));                      \
+            static constinit ::debug::rate_limiter_t _log_limiter_ { &_log_summary_site_ };             \
+            std::uint64_t _log_suppressed_ = 0;                                                         \
+            const bool _log_allowed_ = !::debug::at_line_start()                                        \
+                || _log_limiter_.allow((kind), (limit), _log_suppressed_);                              \
+            if (_log_suppressed_ != 0) {                                                                \
+                ::debug::log(&_log_summary_site_, "suppressed ", _log_suppressed_, " messages\n");      \
+            }                                                                                           \
+            if (_log_allowed_) {                                                                        \
+                _log_call_site(level);                                                                  \
+                ::debug::log(&_log_call_site_, __VA_ARGS__);                                            \
+            }                                                                                           \
+        }                                                                                               \
+    } while (false)
+#define log_every_n(n, level, ...)      print_log_limited(::debug::rate_limit_t::every_n, n, level, __VA_ARGS__)
+#define log_first_n(n, level, ...)      print_log_limited(::debug::rate_limit_t::first_n, n, level, __VA_ARGS__)
+#define log_per_second(n, level, ...)   print_log_limited(::debug::rate_limit_t::per_second, n, level, __VA_ARGS__)
+
 #define DEBUG_LOG           (debug::debug_log)
 #define INFO_LOG            (debug::info_log)
 #define WARNING_LOG         (debug::warning_log)
 #define ERROR_LOG           (debug::error_log)
 
-#define debug_log(...)      print_log(DEBUG_LOG, __VA_ARGS__)
-#define info_log(...)       print_log(INFO_LOG, __VA_ARGS__)
-#define warning_log(...)    print_log(WARNING_LOG, __VA_ARGS__)
-#define error_log(...)      print_log(ERROR_LOG, __VA_ARGS__)
+#define debug_log(...)      print_log_at(0, __VA_ARGS__)
+#define info_log(...)       print_log_at(1, __VA_ARGS__)
+#define warning_log(...)    print_log_at(2, __VA_ARGS__)
+#define error_log(...)      print_log_at(3, __VA_ARGS__)
+
+#include "binary_log.h"
+#include "json_log.h"
 
 #endif // LOG_HPP
@@ -0,0 +1,61 @@
+/* log_file.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef LOG_FILE_H
+#define LOG_FILE_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+// Journaling sink: records are copied into memory-mapped, pre-allocated segment files
+// <directory>/journal-<pid>-<sequence>.log. A background thread keeps the next segment
+// ready, msync()s the dirty range and finalizes (truncates to its used size) full segments,
+// so writing a record is a memcpy and never a write() syscall.
+namespace debug::log_file
+{
+    struct options_t
+    {
+        std::string directory;
+        std::size_t segment_size = 64 * 1024 * 1024;
+        std::chrono::seconds rotate_interval { 0 };         // 0: rotate on size only
+        std::chrono::milliseconds sync_interval { 1000 };
+    };
+
+    extern std::atomic_bool enabled;
+
+    /// Start journaling into options.directory (created if missing), returns false with errno set on failure
+    bool open(const options_t & options);
+
+    /// Finalize the current segment and stop the background thread
+    void close();
+
+    /// Append one record to the journal, caller holds debug::log_mutex.
+    /// A record only spans two segments when it is larger than a whole segment.
+    void write(std::string_view data);
+
+    /// Append to the data copied to the start of every new segment, so that each segment can be
+    /// read on its own (the binary log header and site records). New segments grow past
+    /// options.segment_size as needed to keep at least half of them for records.
+    void add_preamble(std::string_view data);
+}
+
+#endif //LOG_FILE_H
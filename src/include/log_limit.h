@@ -0,0 +1,200 @@
+/* log_limit.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef LOG_LIMIT_H
+#define LOG_LIMIT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+namespace debug
+{
+    struct call_site_t;
+
+    /// Start the thread that calls flush_suppressed() every summary interval and at exit (once)
+    void start_summary_reporter();
+
+    enum class rate_limit_t
+    {
+        every_n,        // log the 1st, (n+1)th, (2n+1)th... call
+        first_n,        // log the first n calls, then stay quiet
+        per_second,     // log at most n calls per second
+    };
+
+    // Per call site state of a rate limited log statement (one static instance each, see log_every_n()).
+    // Lock-free; a suppressed call costs one or two atomic operations and never formats anything.
+    // A limiter that suppressed a call joins a process wide list, so flush_suppressed() can report
+    // the counts that were never summarized because the call site was not hit again.
+    class rate_limiter_t
+    {
+    public:
+        static constexpr std::int64_t summary_interval = 10; // seconds
+
+    private:
+        inline static std::atomic<rate_limiter_t *> pending_list = nullptr;
+
+        const call_site_t * summary_site = nullptr;
+        rate_limiter_t * next_pending = nullptr;
+        std::atomic_bool listed = false;
+        std::atomic_uint64_t state = 0;         // calls so far, or (second << 32 | calls in that second)
+        std::atomic_uint64_t suppressed = 0;
+        std::atomic_int64_t last_summary = 0;
+
+        static std::int64_t monotonic_seconds() noexcept
+        {
+            timespec now {};
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+            return now.tv_sec;
+        }
+
+        [[nodiscard]] std::uint64_t take_suppressed() noexcept
+        {
+            return suppressed.load(std::memory_order_relaxed) == 0 ? 0
+                : suppressed.exchange(0, std::memory_order_relaxed);
+        }
+
+        void suppress() noexcept
+        {
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            if (!listed.load(std::memory_order_relaxed) && !listed.exchange(true, std::memory_order_relaxed))
+            {
+                next_pending = pending_list.load(std::memory_order_relaxed);
+                while (!pending_list.compare_exchange_weak(next_pending, this, std::memory_order_release,
+                    std::memory_order_relaxed))
+                {
+                }
+                start_summary_reporter();
+            }
+        }
+
+        // the suppressed count, at most once per summary_interval; the first call only starts the interval
+        [[nodiscard]] std::uint64_t interval_summary() noexcept
+        {
+            const std::int64_t now = monotonic_seconds();
+            std::int64_t last = last_summary.load(std::memory_order_relaxed);
+            if (last == 0)
+            {
+                last_summary.compare_exchange_strong(last, now, std::memory_order_relaxed);
+                return 0;
+            }
+
+            if (now - last >= summary_interval
+                && last_summary.compare_exchange_strong(last, now, std::memory_order_relaxed))
+            {
+                return take_suppressed();
+            }
+            return 0;
+        }
+
+    public:
+        constexpr rate_limiter_t() noexcept = default;
+
+        /// summary_site is where the "suppressed K messages" line left over at exit is logged from
+        constexpr explicit rate_limiter_t(const call_site_t * summary_site) noexcept : summary_site(summary_site) { }
+
+        /// Calls report(summary site, count) for every limiter holding suppressed calls not reported yet
+        template <typename Function>
+        static void drain_pending(Function && report)
+        {
+            for (auto * limiter = pending_list.load(std::memory_order_acquire); limiter != nullptr;
+                limiter = limiter->next_pending)
+            {
+                if (const auto count = limiter->take_suppressed(); count != 0 && limiter->summary_site != nullptr) {
+                    report(*limiter->summary_site, count);
+                }
+            }
+        }
+
+        /// Returns true if this call may log. report receives the number of calls suppressed
+        /// since the last report, to be logged as a summary line (0: nothing to report).
+        bool allow(const rate_limit_t kind, const std::uint32_t limit, std::uint64_t & report) noexcept
+        {
+            report = 0;
+            switch (kind)
+            {
+                case rate_limit_t::every_n:
+                {
+                    const std::uint64_t n = std::max<std::uint32_t>(limit, 1);
+                    if (state.fetch_add(1, std::memory_order_relaxed) % n != 0)
+                    {
+                        suppress();
+                        return false;
+                    }
+                    report = interval_summary();
+                    return true;
+                }
+
+                case rate_limit_t::first_n:
+                {
+                    // stop counting once saturated, so the cache line is not written on every call
+                    if (state.load(std::memory_order_relaxed) < limit
+                        && state.fetch_add(1, std::memory_order_relaxed) < limit)
+                    {
+                        return true;
+                    }
+
+                    suppress();
+                    report = interval_summary();
+                    return false;
+                }
+
+                case rate_limit_t::per_second:
+                {
+                    if (limit == 0) {
+                        return false;
+                    }
+
+                    const auto now = static_cast<std::uint64_t>(monotonic_seconds()) & 0xFFFFFFFF;
+                    std::uint64_t current = state.load(std::memory_order_relaxed);
+                    while (true)
+                    {
+                        std::uint64_t next;
+                        if (current >> 32 != now) {
+                            next = now << 32 | 1; // a new second began
+                        } else if ((current & 0xFFFFFFFF) < limit) {
+                            next = current + 1;
+                        } else {
+                            suppress();
+                            return false;
+                        }
+
+                        if (state.compare_exchange_weak(current, next, std::memory_order_relaxed))
+                        {
+                            if (current >> 32 != now) {
+                                report = take_suppressed();
+                            }
+                            return true;
+                        }
+                    }
+                }
+            }
+
+            return true;
+        }
+    };
+
+    /// Log the summary line of every rate limited call site with suppressed calls not reported yet.
+    /// The reporter thread runs it periodically and at exit, so counts of quiet call sites are not lost.
+    void flush_suppressed();
+}
+
+#endif //LOG_LIMIT_H
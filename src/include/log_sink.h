@@ -0,0 +1,44 @@
+/* log_sink.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef LOG_SINK_H
+#define LOG_SINK_H
+
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace debug::sink
+{
+    /// Write one complete record
+    void write(std::string_view record);
+
+    /// Write a batch of complete records, as a single writev() when going to a file descriptor
+    void write(std::span<const std::string> records);
+
+    /// Push out anything buffered in between (only the std::ostream path buffers)
+    void flush();
+
+    /// Hand a finished record to the async writer when it runs, or write it right away.
+    /// Records of error level are out before this returns. The record may be moved from.
+    void commit(std::string & record, unsigned int level);
+}
+
+#endif //LOG_SINK_H
@@ -1,9 +1,56 @@
 #ifndef CPPCOWOVERLAY_RSTRING_H
 #define CPPCOWOVERLAY_RSTRING_H
 
+#include <array>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <functional>
-std::string replace_all(std::string & original, const std::string & target, const std::string & replacement);
+#include <unordered_map>
+#include <vector>
+
+// Every non-overlapping occurrence of target, left to right, is replaced in one pass over the text.
+// A copy with the occurrences replaced:
+std::string replace_all(std::string_view original, std::string_view target, std::string_view replacement);
+// The same for a C string, which would otherwise fit the string_view and std::string && overloads equally well:
+std::string replace_all(const char * original, std::string_view target, std::string_view replacement);
+// The same, reusing the buffer of original:
+std::string replace_all(std::string && original, std::string_view target, std::string_view replacement);
+// In place, returns original. Without reallocating unless replacement is longer than target.
+std::string & replace_all(std::string & original, std::string_view target, std::string_view replacement);
+
+// Replaces any of a set of literal patterns in one pass over the text, e.g. variables like %PWD% and
+// %HOME% in a configuration file. The patterns are compiled into an Aho-Corasick automaton once, by
+// the first apply() after the last add(), and the replacer can then be reused for any number of texts.
+// Matches are leftmost-longest and never overlap; replacements are not scanned again.
+class multi_replacer
+{
+    std::vector<std::string> patterns;
+    std::vector<std::string> replacements;
+    std::unordered_map<std::string, std::size_t> pattern_index;
+
+    // automaton, states are rows of classes_count transitions
+    std::array<std::uint8_t, 256> byte_class {};    // bytes not in any pattern share class 0
+    std::size_t classes_count = 0;
+    std::vector<std::uint32_t> transitions;
+    std::vector<std::uint32_t> depth;               // length of the prefix a state stands for
+    std::vector<std::int32_t> longest_match;        // longest pattern ending at a state, -1 for none
+    bool built = false;
+
+    void build();
+
+public:
+    multi_replacer() = default;
+    explicit multi_replacer(const std::vector<std::pair<std::string, std::string>> & rules);
+
+    /// Empty patterns are ignored; if a pattern is added twice, the later replacement is used
+    void add(std::string_view pattern, std::string_view replacement);
+    [[nodiscard]] bool empty() const { return patterns.empty(); }
+
+    std::string apply(std::string_view text);
+};
+
+// Every distinct match of pattern is replaced by replacement(match), all in one pass
 std::string regex_replace_all(std::string & original, const std::string & pattern, const std::function<std::string(const std::string &)>& replacement);
 
 #endif //CPPCOWOVERLAY_RSTRING_H
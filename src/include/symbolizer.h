@@ -0,0 +1,46 @@
+/* symbolizer.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SYMBOLIZER_H
+#define SYMBOLIZER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// In-process replacement for addr2line: every loaded object (found through dl_iterate_phdr)
+// is mapped once, its .symtab (or .dynsym) and .debug_line (DWARF 2 to 5) are turned into
+// address sorted tables, and frames are resolved by binary search. Results are cached.
+namespace debug::symbolizer
+{
+    struct frame_t
+    {
+        std::string function;       // demangled, empty if no symbol covers the address
+        std::string file;           // empty without line information
+        unsigned int line = 0;
+        std::string object;         // executable or shared object containing the address
+        std::uintptr_t offset = 0;  // address relative to the load base of object
+    };
+
+    /// Resolve return addresses as captured by backtrace()
+    std::vector<frame_t> resolve(void * const * frames, int count);
+}
+
+#endif //SYMBOLIZER_H
@@ -0,0 +1,59 @@
+/* timestamp.h
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+namespace debug::timestamp
+{
+    enum class precision_t
+    {
+        seconds,        // 2025-01-31 12:34:56
+        milliseconds,   // 2025-01-31 12:34:56.789
+        microseconds,   // 2025-01-31 12:34:56.789012
+    };
+
+    extern std::atomic<precision_t> precision;
+
+    constexpr std::size_t max_length = 32;
+
+    /// Render the current local time into buffer (at least max_length bytes).
+    /// The "YYYY-MM-DD HH:MM:SS" part is rendered once per second and shared between threads,
+    /// the UTC offset is looked up once a minute instead of through the tz database per line.
+    std::string_view now(char * buffer);
+
+    /// Render an arbitrary point in time, given as nanoseconds since the UNIX epoch
+    std::string_view render(char * buffer, std::int64_t epoch_ns);
+
+    /// Same, at a fixed UTC offset in seconds instead of the local one (e.g. the offset of the machine that wrote a log)
+    std::string_view render(char * buffer, std::int64_t epoch_ns, std::int64_t utc_offset);
+
+    /// Local UTC offset in seconds at the given second since the UNIX epoch
+    std::int64_t utc_offset(std::int64_t utc_second);
+
+    /// Current wall clock in nanoseconds since the UNIX epoch, at the resolution the precision needs
+    std::int64_t clock_ns();
+}
+
+#endif //TIMESTAMP_H
@@ -0,0 +1,448 @@
+/* log_decoder.cpp
+ *
+ * Copyright 2025 Anivice Ives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+// Renders a LOG_FORMAT=binary stream (see binary_log.h) back into the text format of debug::log()
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <ranges>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include "binary_log.h"
+#include "color.h"
+#include "error.h"
+#include "hex_dump.h"
+#include "timestamp.h"
+
+def_except_no_trace(malformed_log);
+
+namespace {
+    struct site_t
+    {
+        std::uint32_t level {};
+        std::uint32_t line {};
+        std::string function;
+        std::string file;
+        std::string signature;
+    };
+
+    class reader_t
+    {
+        const std::string & data;
+        std::size_t pos = 0;
+
+    public:
+        explicit reader_t(const std::string & data) : data(data) { }
+
+        [[nodiscard]] bool eof() const { return pos == data.size(); }
+        [[nodiscard]] std::size_t position() const { return pos; }
+
+        // the try_ forms report a short read as an error value, probe_record() relies on them
+        template <typename T>
+        cow_expected<T> try_get()
+        {
+            cow_check_wm(data.size() - pos >= sizeof(T), malformed_log, "truncated record");
+            T value;
+            std::memcpy(&value, data.data() + pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        cow_expected<std::string_view> try_get_bytes(const std::size_t size)
+        {
+            cow_check_wm(data.size() - pos >= size, malformed_log, "truncated record");
+            const std::string_view result(data.data() + pos, size);
+            pos += size;
+            return result;
+        }
+
+        template <typename T>
+        T get() {
+            return cow_value_or_raise(try_get<T>());
+        }
+
+        std::string_view get_bytes(const std::size_t size) {
+            return cow_value_or_raise(try_get_bytes(size));
+        }
+
+        std::string_view get_string() {
+            return get_bytes(get<std::uint32_t>());
+        }
+    };
+
+    // index right after the type starting at sig[pos]
+    std::size_t skip_type(const std::string_view sig, std::size_t pos)
+    {
+        cow_assert_wm(pos < sig.size(), malformed_log, "bad signature");
+        const char open = sig[pos++];
+        if (open != debug::binary::code::container_begin && open != debug::binary::code::map_begin
+            && open != debug::binary::code::pair_begin)
+        {
+            return pos;
+        }
+
+        const char close = open == debug::binary::code::container_begin ? debug::binary::code::container_end
+            : open == debug::binary::code::map_begin ? debug::binary::code::map_end : debug::binary::code::pair_end;
+        while (pos < sig.size() && sig[pos] != close) {
+            pos = skip_type(sig, pos);
+        }
+        cow_assert_wm(pos < sig.size(), malformed_log, "bad signature");
+        return pos + 1;
+    }
+
+    class renderer_t
+    {
+        // a line logged in several parts is collected per thread and written out once complete,
+        // like the per thread buffer of the text mode does
+        struct thread_line_t
+        {
+            std::ostringstream text;
+            bool at_line_start = true;
+        };
+
+        std::ostream & output;
+        std::ostream * out = nullptr; // text of the thread whose record is being rendered
+        bool verbose = false;
+        std::int64_t utc_offset = 0;
+        std::map<std::uint32_t, thread_line_t> threads;
+        std::string dump;
+        std::string last_build_id;
+        std::unordered_map<std::uint32_t, site_t> sites;
+
+        // same layout as debug::print_container()
+        void render_container(reader_t & reader, const std::string_view sig, const std::size_t pos)
+        {
+            constexpr std::uint64_t max_elements = 8;
+            const auto count = reader.get<std::uint32_t>();
+            if (sig[pos] == debug::binary::code::byte) // byte containers are dumped in one piece
+            {
+                const auto bytes = reader.get_bytes(count);
+                dump.clear();
+                debug::hex_dump(dump, bytes.data(), bytes.size());
+                *out << dump;
+                return;
+            }
+
+            std::uint64_t num_elements = 0;
+            *out << "[";
+            for (std::uint32_t i = 0; i < count; i++)
+            {
+                if (num_elements == max_elements)
+                {
+                    *out << "\n" << "    ";
+                    num_elements = 0;
+                }
+
+                render_value(reader, sig, pos);
+                if (i + 1 != count) {
+                    *out << ", ";
+                }
+                num_elements++;
+            }
+            *out << "]";
+        }
+
+        void render_map(reader_t & reader, const std::string_view sig, const std::size_t pos)
+        {
+            const auto count = reader.get<std::uint32_t>();
+            const std::size_t value_pos = skip_type(sig, pos);
+            *out << "{";
+            for (std::uint32_t i = 0; i < count; i++)
+            {
+                render_value(reader, sig, pos);
+                *out << ": ";
+                render_value(reader, sig, value_pos);
+                if (i + 1 != count) {
+                    *out << ", ";
+                }
+            }
+            *out << "}";
+        }
+
+        // returns the string value for the end-of-line check, if the value was a string
+        std::string_view render_value(reader_t & reader, const std::string_view sig, const std::size_t pos)
+        {
+            namespace code = debug::binary::code;
+            switch (sig[pos])
+            {
+                case code::boolean: *out << (reader.get<std::uint8_t>() ? "True" : "False"); break;
+                case code::character:
+                {
+                    const char c = static_cast<char>(reader.get<std::uint8_t>());
+                    *out << c;
+                    return c == '\n' ? "\n" : "";
+                }
+                case code::signed_integer: *out << reader.get<std::int64_t>(); break;
+                case code::unsigned_integer: *out << reader.get<std::uint64_t>(); break;
+                case code::floating: *out << reader.get<double>(); break;
+                case code::string:
+                {
+                    const auto str = reader.get_string();
+                    *out << str;
+                    return str;
+                }
+                case code::text: *out << reader.get_string(); break;
+                case code::pointer:
+                    *out << reinterpret_cast<const void *>(static_cast<std::uintptr_t>(reader.get<std::uint64_t>()));
+                    break;
+                case code::manipulator:
+                    switch (reader.get<std::uint8_t>())
+                    {
+                        case debug::binary::manip_dec: *out << std::dec; break;
+                        case debug::binary::manip_hex: *out << std::hex; break;
+                        case debug::binary::manip_oct: *out << std::oct; break;
+                        case debug::binary::manip_fixed: *out << std::fixed; break;
+                        case debug::binary::manip_scientific: *out << std::scientific; break;
+                        default: break;
+                    }
+                    break;
+                case code::move_front: *out << "\033[F\033[K"; break;
+                case code::cursor_off: *out << "\033[?25l"; break;
+                case code::cursor_on: *out << "\033[?25h"; break;
+                case code::nothing: break;
+                case code::container_begin: render_container(reader, sig, pos + 1); break;
+                case code::map_begin: render_map(reader, sig, pos + 1); break;
+                case code::pair_begin:
+                    *out << "<";
+                    render_value(reader, sig, pos + 1);
+                    *out << ": ";
+                    render_value(reader, sig, skip_type(sig, pos + 1));
+                    *out << ">";
+                    break;
+                default: throw malformed_log("unknown type code in signature");
+            }
+
+            return "";
+        }
+
+        void read_site(reader_t & reader)
+        {
+            const auto id = reader.get<std::uint32_t>();
+            site_t site;
+            site.level = reader.get<std::uint32_t>();
+            site.line = reader.get<std::uint32_t>();
+            site.function = reader.get_string();
+            site.file = reader.get_string();
+            site.signature = reader.get_string();
+            sites[id] = std::move(site);
+        }
+
+        // mirrors debug::_log_record()
+        void read_log(reader_t & reader)
+        {
+            const auto id = reader.get<std::uint32_t>();
+            auto & thread = threads[reader.get<std::uint32_t>()];
+            const auto level = reader.get<std::uint8_t>();
+            const auto epoch_ns = reader.get<std::int64_t>();
+            reader.get<std::uint32_t>(); // payload size, only needed to skip unknown records
+            const auto site = sites.find(id);
+            cow_assert_wm(site != sites.end(), malformed_log, "log record for an unknown call site");
+
+            out = &thread.text;
+            if (thread.at_line_start)
+            {
+                std::string_view prefix_color, prefix;
+                switch (level)
+                {
+                    case 0: prefix_color = color::color(1,1,1); prefix = "[DEBUG]"; break;
+                    case 1: prefix_color = color::color(5,5,5); prefix = "[INFO]"; break;
+                    case 2: prefix_color = color::color(0,5,5); prefix = "[WARNING]"; break;
+                    case 3: prefix_color = color::color(5,0,0); prefix = "[ERROR]"; break;
+                    default: prefix_color = color::color(5,5,5); prefix = "[INFO]"; break;
+                }
+
+                char time_buffer[debug::timestamp::max_length];
+                *out << color::color(0, 2, 2) << debug::timestamp::render(time_buffer, epoch_ns, utc_offset) << " ";
+                if (!site->second.function.empty() || !site->second.file.empty())
+                {
+                    *out << color::color(2,3,4) << "(" << site->second.function;
+                    if (verbose) {
+                        *out << " " << site->second.file << ":" << site->second.line;
+                    }
+                    *out << ") ";
+                }
+                *out << prefix_color << prefix << ": " << color::no_color();
+            }
+
+            const std::string_view sig = site->second.signature;
+            std::string_view last;
+            for (std::size_t pos = 0; pos < sig.size(); pos = skip_type(sig, pos)) {
+                last = render_value(reader, sig, pos);
+            }
+            thread.at_line_start = !last.empty() && last.back() == '\n';
+            if (thread.at_line_start)
+            {
+                output << thread.text.view();
+                thread.text.str({});
+            }
+        }
+
+        // Checks on a copy of the reader that the record at its position is all there. A writer killed
+        // in the middle of a record leaves a truncated tail, which ends the stream instead of failing it.
+        static cow_expected<void> probe_record(reader_t reader, const char first_byte)
+        {
+            const auto skip_string = [&reader]() -> cow_expected<void>
+            {
+                const auto size = reader.try_get<std::uint32_t>();
+                cow_propagate(size);
+                cow_propagate(reader.try_get_bytes(*size));
+                return {};
+            };
+
+            if (first_byte == debug::binary::magic[0]) // header of the next journal segment
+            {
+                cow_propagate(reader.try_get_bytes(sizeof(debug::binary::magic) + sizeof(std::uint8_t)));
+                cow_propagate(skip_string());
+                cow_propagate(reader.try_get_bytes(sizeof(std::int32_t)));
+                return {};
+            }
+
+            const auto kind = reader.try_get<std::uint8_t>();
+            cow_propagate(kind);
+            switch (*kind)
+            {
+                case debug::binary::site_record:
+                    cow_propagate(reader.try_get_bytes(3 * sizeof(std::uint32_t)));
+                    cow_propagate(skip_string());
+                    cow_propagate(skip_string());
+                    return skip_string();
+                case debug::binary::log_record:
+                {
+                    // id, thread, level, epoch_ns
+                    cow_propagate(reader.try_get_bytes(2 * sizeof(std::uint32_t) + sizeof(std::uint8_t)
+                        + sizeof(std::int64_t)));
+                    const auto payload_size = reader.try_get<std::uint32_t>();
+                    cow_propagate(payload_size);
+                    cow_propagate(reader.try_get_bytes(*payload_size));
+                    return {};
+                }
+                default:
+                    return {}; // rejected as an unknown record type by render()
+            }
+        }
+
+        void read_header(reader_t & reader)
+        {
+            for (const char c : debug::binary::magic) {
+                cow_assert_wm(reader.get<char>() == c, malformed_log, "not a binary log stream");
+            }
+            verbose = reader.get<std::uint8_t>() != 0;
+            const auto build_id = reader.get_string();
+            utc_offset = reader.get<std::int32_t>();
+            if (build_id != last_build_id)
+            {
+                std::cerr << "Log produced by build " << build_id << std::endl;
+                last_build_id = build_id;
+            }
+        }
+
+    public:
+        explicit renderer_t(std::ostream & output) : output(output) { }
+
+        void render(const std::string & data)
+        {
+            reader_t reader(data);
+            read_header(reader);
+            while (!reader.eof())
+            {
+                if (const auto complete = probe_record(reader, data[reader.position()]); !complete)
+                {
+                    std::cerr << "Stopping at a truncated record, " << data.size() - reader.position()
+                              << " bytes left undecoded (" << complete.error().text() << ")" << std::endl;
+                    break;
+                }
+
+                // every journal segment starts with its own header, concatenated segments decode in one go
+                if (data[reader.position()] == debug::binary::magic[0])
+                {
+                    read_header(reader);
+                    continue;
+                }
+
+                switch (reader.get<std::uint8_t>())
+                {
+                    case debug::binary::site_record: read_site(reader); break;
+                    case debug::binary::log_record: read_log(reader); break;
+                    default: throw malformed_log("unknown record type");
+                }
+            }
+
+            // unfinished lines of threads that logged nothing more, as the text mode writes them when a thread exits
+            for (auto & thread : threads | std::views::values) {
+                output << thread.text.view();
+            }
+            output << std::flush;
+        }
+    };
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc > 2)
+    {
+        std::cerr << "Usage: " << *argv << " [BINARY LOG FILE]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (const auto precision_env = std::getenv("LOG_TIME_PRECISION"); precision_env != nullptr)
+    {
+        std::string precision = precision_env;
+        std::ranges::transform(precision, precision.begin(), ::tolower);
+        if (precision == "ms") {
+            debug::timestamp::precision = debug::timestamp::precision_t::milliseconds;
+        } else if (precision == "us") {
+            debug::timestamp::precision = debug::timestamp::precision_t::microseconds;
+        }
+    }
+
+    try
+    {
+        std::string data;
+        if (argc == 2)
+        {
+            std::ifstream file(argv[1], std::ios::binary);
+            if (!file)
+            {
+                std::cerr << "Cannot open " << argv[1] << ": " << std::strerror(errno) << std::endl;
+                return EXIT_FAILURE;
+            }
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        else
+        {
+            data.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        }
+
+        renderer_t(std::cout).render(data);
+    }
+    catch (std::exception & e)
+    {
+        std::cout << std::flush;
+        std::cerr << "\n" << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,42 +1,267 @@
 #include "rstring.h"
+#include <algorithm>
 #include <regex>
+#include <unordered_set>
 
-std::string replace_all(
-    std::string & original,
-    const std::string & target,
-    const std::string & replacement)
+namespace {
+    // number of non-overlapping occurrences of target, which is not empty
+    size_t count_matches(const std::string_view text, const std::string_view target)
+    {
+        size_t count = 0;
+        for (size_t pos = 0; (pos = text.find(target, pos)) != std::string_view::npos; pos += target.size()) {
+            count++;
+        }
+        return count;
+    }
+
+    // copies text into out with target replaced, out must have room for exactly the result
+    void copy_replaced(const std::string_view text, const std::string_view target, const std::string_view replacement, char * out)
+    {
+        size_t pos = 0, match;
+        while ((match = text.find(target, pos)) != std::string_view::npos)
+        {
+            out = std::copy(text.begin() + pos, text.begin() + match, out);
+            out = std::copy(replacement.begin(), replacement.end(), out);
+            pos = match + target.size();
+        }
+        std::copy(text.begin() + pos, text.end(), out);
+    }
+}
+
+std::string replace_all(const std::string_view original, const std::string_view target, const std::string_view replacement)
+{
+    if (target.empty()) return std::string(original); // Avoid infinite loop if target is empty
+
+    const size_t count = count_matches(original, target);
+    const size_t size = original.size() - count * target.size() + count * replacement.size();
+    std::string result;
+    // size the output once, then copy the pieces between matches and the replacements in
+    // (the size argument of the callback is not reliable with libstdc++ 12)
+    result.resize_and_overwrite(size, [&](char * data, size_t) {
+        copy_replaced(original, target, replacement, data);
+        return size;
+    });
+    return result;
+}
+
+std::string replace_all(const char * original, const std::string_view target, const std::string_view replacement)
+{
+    return replace_all(std::string_view(original), target, replacement);
+}
+
+std::string replace_all(std::string && original, const std::string_view target, const std::string_view replacement)
+{
+    replace_all(original, target, replacement);
+    return std::move(original);
+}
+
+std::string & replace_all(std::string & original, const std::string_view target, const std::string_view replacement)
 {
     if (target.empty()) return original; // Avoid infinite loop if target is empty
 
-    if (target.size() == 1 && replacement.empty()) {
-        std::erase_if(original, [&target](const char c) { return c == target[0]; });
+    if (replacement.size() > target.size())
+    {
+        // the text grows, build it in a new buffer sized once instead of shifting the tail for every match
+        if (original.find(target) != std::string::npos) {
+            original = replace_all(std::string_view(original), target, replacement);
+        }
         return original;
     }
 
-    size_t pos = 0;
-    while ((pos = original.find(target, pos)) != std::string::npos) {
-        original.replace(pos, target.length(), replacement);
-        pos += replacement.length(); // Move past the replacement to avoid infinite loop
+    // not longer: the result is written over the text itself, the write position never passes the read position
+    size_t read = 0, write = 0, match;
+    while ((match = original.find(target, read)) != std::string::npos)
+    {
+        if (write != read) {
+            std::copy(original.begin() + read, original.begin() + match, original.begin() + write);
+        }
+        write += match - read;
+        std::copy(replacement.begin(), replacement.end(), original.begin() + write);
+        write += replacement.size();
+        read = match + target.size();
+    }
+
+    if (write != read)
+    {
+        std::copy(original.begin() + read, original.end(), original.begin() + write);
+        original.resize(write + original.size() - read);
     }
     return original;
 }
 
+multi_replacer::multi_replacer(const std::vector<std::pair<std::string, std::string>> & rules)
+{
+    for (const auto & [pattern, replacement] : rules) {
+        add(pattern, replacement);
+    }
+}
+
+void multi_replacer::add(const std::string_view pattern, const std::string_view replacement)
+{
+    if (pattern.empty()) return;
+
+    built = false;
+    const auto [existing, inserted] = pattern_index.try_emplace(std::string(pattern), patterns.size());
+    if (!inserted)
+    {
+        replacements[existing->second] = replacement;
+        return;
+    }
+
+    patterns.emplace_back(pattern);
+    replacements.emplace_back(replacement);
+}
+
+void multi_replacer::build()
+{
+    // only bytes that occur in patterns get a class of their own, which keeps the table small
+    byte_class.fill(0);
+    classes_count = 1;
+    for (const auto & pattern : patterns)
+    {
+        for (const char c : pattern)
+        {
+            auto & byte = byte_class[static_cast<std::uint8_t>(c)];
+            if (byte == 0) {
+                byte = static_cast<std::uint8_t>(classes_count++);
+            }
+        }
+    }
+
+    // the trie, 0 in transitions meaning no edge yet (nothing leads back to the root in a trie)
+    transitions.assign(classes_count, 0);
+    depth.assign(1, 0);
+    longest_match.assign(1, -1);
+    for (size_t index = 0; index < patterns.size(); index++)
+    {
+        std::uint32_t state = 0;
+        for (const char c : patterns[index])
+        {
+            auto & next = transitions[state * classes_count + byte_class[static_cast<std::uint8_t>(c)]];
+            if (next == 0)
+            {
+                next = static_cast<std::uint32_t>(depth.size());
+                depth.push_back(depth[state] + 1);
+                longest_match.push_back(-1);
+                transitions.resize(transitions.size() + classes_count, 0);
+            }
+            state = transitions[state * classes_count + byte_class[static_cast<std::uint8_t>(c)]];
+        }
+        longest_match[state] = static_cast<std::int32_t>(index);
+    }
+
+    // breadth first: missing edges borrow those of the failure state, and a state without a pattern
+    // of its own inherits the longest one ending there through the failure chain
+    std::vector<std::uint32_t> failure(depth.size(), 0);
+    std::vector<std::uint32_t> queue;
+    for (size_t c = 0; c < classes_count; c++)
+    {
+        if (const auto next = transitions[c]; next != 0) {
+            queue.push_back(next);
+        }
+    }
+
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        const std::uint32_t state = queue[head];
+        if (longest_match[state] == -1) {
+            longest_match[state] = longest_match[failure[state]];
+        }
+
+        for (size_t c = 0; c < classes_count; c++)
+        {
+            auto & next = transitions[state * classes_count + c];
+            const auto fallback = transitions[failure[state] * classes_count + c];
+            if (next == 0) {
+                next = fallback;
+            }
+            else
+            {
+                failure[next] = fallback;
+                queue.push_back(next);
+            }
+        }
+    }
+
+    built = true;
+}
+
+std::string multi_replacer::apply(const std::string_view text)
+{
+    if (patterns.empty()) return std::string(text);
+    if (!built) build();
+
+    std::string result;
+    result.reserve(text.size());
+
+    // The automaton reports the longest pattern ending at each position. A candidate is kept until
+    // the automaton has moved past its start (depth says where the longest live prefix begins), since
+    // only then can no match starting earlier, or at the same place but longer, turn up any more.
+    // Scanning starts over from the root at the end of every match taken.
+    size_t copied = 0;                  // text before this is in result already
+    size_t position = 0;
+    std::uint32_t state = 0;
+    std::int32_t candidate = -1;
+    size_t candidate_start = 0;
+    const auto take_candidate = [&]
+    {
+        result.append(text, copied, candidate_start - copied);
+        result.append(replacements[candidate]);
+        copied = position = candidate_start + patterns[candidate].size();
+        state = 0;
+        candidate = -1;
+    };
+
+    while (position < text.size())
+    {
+        state = transitions[state * classes_count + byte_class[static_cast<std::uint8_t>(text[position])]];
+        position++;
+
+        if (const std::int32_t match = longest_match[state]; match != -1)
+        {
+            const size_t start = position - patterns[match].size();
+            if (candidate == -1 || start < candidate_start) // same start: the earlier report was the shorter one
+            {
+                candidate = match;
+                candidate_start = start;
+            }
+            else if (start == candidate_start) {
+                candidate = match;
+            }
+        }
+
+        if (candidate != -1 && position - depth[state] > candidate_start) {
+            take_candidate();
+        }
+        else if (candidate != -1 && position == text.size()) {
+            take_candidate();
+        }
+    }
+
+    result.append(text, copied);
+    return result;
+}
+
 std::string regex_replace_all(std::string & original, const std::string & pattern, const std::function<std::string(const std::string &)>& replacement)
 {
-    std::vector < std::string > replace_list;
+    // every distinct match becomes a literal pattern, so each is replaced wherever it occurs, as before,
+    // but in a single pass that never looks at replaced text again
+    multi_replacer replacer;
     const std::regex pattern_rgx(pattern);
     const auto matches_begin = std::sregex_iterator(begin(original), end(original), pattern_rgx);
     const auto matches_end = std::sregex_iterator();
+    std::unordered_set < std::string > seen;
     for (std::sregex_iterator i = matches_begin; i != matches_end; ++i)
     {
-        const auto match = i->str();
-        replace_list.emplace_back(match);
+        if (auto match = i->str(); !match.empty() && !seen.contains(match))
+        {
+            replacer.add(match, replacement(match));
+            seen.emplace(std::move(match));
+        }
     }
 
-    for (const auto & word : replace_list)
-    {
-        replace_all(original, word, replacement(word));
+    if (!replacer.empty()) {
+        original = replacer.apply(original);
     }
-
     return original;
 }